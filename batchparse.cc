@@ -0,0 +1,210 @@
+
+// The batch parser.
+
+#include "batchparse.hh"
+#include "parse.hh"
+
+#include <ctype.h>
+
+static const char * Skip (const char * input)
+{
+   while (isspace (*input)) {
+      ++input;
+   }
+   return input;
+}
+
+BatchParser::Error BatchParser::Parse (const char * input, Tree & term)
+{
+   error = OK;
+   begin = input;
+   if (positions != NULL) {
+      positions->clear();
+   }
+   const char * end = Term (term, NULL, input);
+   if (end == NULL) {
+      return error;
+   }
+   if (*Skip (end) != 0) {
+      where = Skip (end);
+      return TRAILING;
+   }
+   return OK;
+}
+
+const char * BatchParser::Term (Tree & term, const Scope * scope,
+                                const char * input)
+{
+   const char * start = Skip (input);
+   input = NonArrowTerm (term, scope, input);
+   if (input == NULL || *input != '>') {
+      return input;
+   }
+
+   Tree second;
+   const char * secondStart = Skip (input + 1);
+   input = Term (second, scope, input + 1);
+   if (input == NULL) {
+      return NULL;
+   }
+   // Lifted, second is under the new binder.
+   Tree lifted = Lift (second, 0);
+   Note (lifted, Depth (scope) + 1, secondStart);
+   term = Pair (0, Pair (term, lifted));
+   Note (term, Depth (scope), start);
+   return input;
+}
+
+const char * BatchParser::NonArrowTerm (Tree & term, const Scope * scope,
+                                        const char * input)
+{
+   const char * start = Skip (input);
+   input = UnappliedTerm (term, scope, start);
+
+   while (input != NULL) {
+      input = Skip (input);
+      if (!*input ||
+          *input == ']' ||
+          *input == ')' ||
+          *input == '}' ||
+          *input == '>') {
+         return input;
+      }
+
+      Tree arg;
+      input = UnappliedTerm (arg, scope, input);
+      if (input == NULL) {
+         return NULL;
+      }
+      term = Pair (2, Pair (term, arg));
+      Note (term, Depth (scope), start);
+   }
+   return NULL;
+}
+
+const char * BatchParser::UnappliedTerm (Tree & term, const Scope * scope,
+                                         const char * input)
+{
+   const char * start = input;
+   if (*input == '(') {
+      input = Term (term, scope, input + 1);
+      return input == NULL ? NULL : Check (')', input);
+   }
+
+   if (*input == '[' || *input == '{') {
+      bool isLambda = *input == '[';
+      Name name;
+      input = Identifier (name, Skip (input + 1));
+      if (input == NULL || (input = Check (':', input)) == NULL) {
+         return NULL;
+      }
+      Tree argType;
+      input = Term (argType, scope, input);
+      if (input == NULL
+          || (input = Check (isLambda ? ']' : '}', input)) == NULL) {
+         return NULL;
+      }
+
+      Scope inner = { Bind (name), scope, Depth (scope) + 1 };
+      Tree bodyTerm;
+      input = Term (bodyTerm, &inner, input);
+      if (input == NULL) {
+         return NULL;
+      }
+      term = Pair (isLambda, Pair (argType, bodyTerm));
+      Note (term, Depth (scope), start);
+      return input;
+   }
+
+   if (*input == '*') {
+      term = Pair (3, 0);
+      Note (term, Depth (scope), start);
+      return Skip (input + 1);
+   }
+
+   Name name;
+   input = Identifier (name, input);
+   if (input == NULL) {
+      return NULL;
+   }
+   int id = Find (name);
+   int index = 0;
+   for (; scope != NULL; scope = scope->outer, ++index) {
+      if (scope->id == id) {
+         term = Pair (4 + 2 * index, 0);
+         Note (term, Depth (scope) + index, start);
+         return input;
+      }
+   }
+
+   error = FREE_VARIABLE;
+   where = start;
+   return NULL;
+}
+
+const char * BatchParser::Identifier (Name & name, const char * input)
+{
+   const char * start = input;
+   while (isalnum (*input)) {
+      ++input;
+   }
+   if (input == start) {
+      error = EXPECTED;
+      expected = 'a';
+      where = start;
+      return NULL;
+   }
+   name.start = start;
+   name.length = input - start;
+   return input;
+}
+
+const char * BatchParser::Check (char c, const char * input)
+{
+   input = Skip (input);
+   if (*input != c) {
+      error = EXPECTED;
+      expected = c;
+      where = input;
+      return NULL;
+   }
+   return Skip (input + 1);
+}
+
+int BatchParser::Bind (const Name & name)
+{
+   std::unordered_map <Name, int, NameHash>::const_iterator i =
+      ids.find (name);
+   if (i != ids.end()) {
+      return i->second;
+   }
+   names.push_back (std::string (name.start, name.length));
+   Name key = { names.back().data(), name.length };
+   int id = ids.size();
+   ids[key] = id;
+   return id;
+}
+
+int BatchParser::Find (const Name & name) const
+{
+   std::unordered_map <Name, int, NameHash>::const_iterator i =
+      ids.find (name);
+   return i == ids.end() ? -1 : i->second;
+}
+
+std::ostream & BatchParser::Report (std::ostream & s, Error e,
+                                    const char * input) const
+{
+   switch (e) {
+   case OK:
+      return s << "OK";
+   case EXPECTED:
+      return s << "Expected '" << expected << "' at position "
+               << where - input;
+   case FREE_VARIABLE:
+      return s << "Free variable at position " << where - input;
+   case TRAILING:
+      return s << "Unexpected text at position " << where - input;
+   }
+   return s;
+}
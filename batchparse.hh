@@ -0,0 +1,131 @@
+#ifndef BATCHPARSE_HH_
+#define BATCHPARSE_HH_
+
+// A parser for many terms, e.g., a corpus of one term per line, with the same
+// grammar as ParseTerm (see parse.hh) but less overhead per term.  Bound
+// variables are kept in a linked list of scopes on the stack rather than a
+// VarList copied at each binder; identifiers are looked up in a table, which
+// lives as long as the parser, straight from the input rather than via a
+// std::string; and errors are returned rather than thrown.
+
+// Unlike ParseTerm, a free variable is an error, as the terms are to be
+// derived in the empty context.
+
+#include "tree.hh"
+
+#include <deque>
+#include <stdint.h>
+#include <string>
+#include <string.h>
+#include <unordered_map>
+#include <utility>
+
+// Where in the input each subterm was parsed, keyed on the subterm and the
+// number of binders it is under.  As terms are hash-consed, the same key can
+// come from several places; the first is kept.
+struct SourceKeyHash
+{
+   size_t operator() (const std::pair <NodeRef, size_t> & key) const
+      {
+         return std::hash <NodeRef>() (key.first) * 0x9E3779B97F4A7C15ull
+            ^ key.second;
+      }
+};
+
+typedef std::unordered_map <std::pair <NodeRef, size_t>, size_t,
+                            SourceKeyHash> SourcePositions;
+
+class BatchParser
+{
+public:
+   enum Error {
+      OK,
+      EXPECTED,                 // 'expected' was not found at 'where'.
+      FREE_VARIABLE,            // The identifier at 'where'.
+      TRAILING                  // Unexpected text at 'where'.
+   };
+
+   BatchParser() : positions (NULL) { }
+
+   // Parse the whole of the NUL terminated 'input' as a term.  If 'positions'
+   // is set, it is cleared and filled in.
+   Error Parse (const char * input, Tree & term);
+
+   SourcePositions * positions;
+
+   const char * where;
+   char expected;
+
+   // Describe the last error, given the input it was in.
+   std::ostream & Report (std::ostream & s, Error error,
+                          const char * input) const;
+
+private:
+   struct Scope
+   {
+      int id;
+      const Scope * outer;
+      size_t depth;             // The number of scopes, this one included.
+   };
+
+   static size_t Depth (const Scope * scope)
+      {
+         return scope != NULL ? scope->depth : 0;
+      }
+
+   // Record where term, under 'depth' binders, started.
+   void Note (Tree term, size_t depth, const char * start)
+      {
+         if (positions != NULL) {
+            positions->emplace (std::make_pair (term.it, depth),
+                                start - begin);
+         }
+      }
+
+   // These return NULL on an error, having set 'where' and so on.
+   const char * Term (Tree & term, const Scope * scope, const char * input);
+   const char * NonArrowTerm (Tree & term, const Scope * scope,
+                              const char * input);
+   const char * UnappliedTerm (Tree & term, const Scope * scope,
+                               const char * input);
+   // An identifier: 'length' characters at 'start', in the input or in
+   // names.
+   struct Name
+   {
+      const char * start;
+      size_t length;
+
+      bool operator== (const Name & other) const
+         {
+            return length == other.length
+               && memcmp (start, other.start, length) == 0;
+         }
+   };
+
+   // FNV-1a.
+   struct NameHash
+   {
+      size_t operator() (const Name & name) const
+         {
+            uint64_t h = 0xCBF29CE484222325ull;
+            for (size_t i = 0; i != name.length; ++i) {
+               h = (h ^ (unsigned char) name.start[i]) * 0x100000001B3ull;
+            }
+            return h;
+         }
+   };
+
+   const char * Identifier (Name & name, const char * input);
+   const char * Check (char c, const char * input);
+
+   // The id of a bound name, adding it if new; or -1 for a name never bound.
+   int Bind (const Name & name);
+   int Find (const Name & name) const;
+
+   Error error;
+   const char * begin;          // Of the input.
+   std::unordered_map <Name, int, NameHash> ids;
+   std::deque <std::string> names;      // What the keys of ids point into.
+};
+
+#endif
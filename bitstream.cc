@@ -5,9 +5,19 @@
 // function.
 
 #include "bitstream.hh"
+#include "memo.hh"
+
+#include <limits.h>
+#include <unordered_map>
+#include <utility>
 
 static bool NormalisedEquals (const Context & a, const Context & b);
 
+class Shortest;
+
+// State pushes the bits onto 'bits', or, with 'bits' NULL, only counts them in
+// 'length'.  The auxiliary derivations come from Generate(), or from
+// 'shortest' if set.
 struct State
 {
    enum Code {
@@ -20,9 +30,11 @@ struct State
       INTRO
    };
 
-   State (Bits & b) :
+   State (Bits * b, Shortest * s = NULL) :
       code (WHILE),
       bits (b),
+      shortest (s),
+      length (0),
       term (7),                 // STAR.
       type (14),                // BOX.
       auxTerm (0),
@@ -30,6 +42,14 @@ struct State
       { }
 
 
+   void Push (bool bit)
+      {
+         if (bits != NULL) {
+            bits->push_back (bit);
+         }
+         ++length;
+      }
+
    void Generate (const Context & c, Tree term);
 
    void Advance();
@@ -45,7 +65,9 @@ struct State
 
    Code code;
 
-   Bits & bits;
+   Bits * bits;
+   Shortest * shortest;
+   size_t length;
 
    Tree term;
    Tree type;
@@ -56,15 +78,327 @@ struct State
    Context auxContext;
 };
 
+// The same auxiliary terms are generated again and again, e.g., a context
+// item for each weakening past it.  What Generate() makes of a context and
+// term is always the same, so we memoise the bits and type, keyed on the
+// (interned) context and term.  parse never calls Collect(), so the keys stay
+// valid.  The segments are kept as Bits rather than Trees, so that splicing
+// one in is a word at a time.
+struct Segment
+{
+   Bits bits;
+   Tree type;
+};
+
+struct SegmentKeyHash
+{
+   size_t operator() (const std::pair <NodeRef, NodeRef> & key) const
+      {
+         return std::hash <NodeRef>() (key.first) * 0x9E3779B97F4A7C15ull
+            ^ std::hash <NodeRef>() (key.second);
+      }
+};
+
+typedef std::unordered_map <std::pair <NodeRef, NodeRef>, Segment,
+                            SegmentKeyHash> SegmentMap;
+
+static SegmentMap Segments;
+static size_t SegmentBits;      // In all of Segments.
+size_t GenerateMemoBits = size_t (1) << 28;
+
 void Generate (Bits & bits, const Context & context,
                Tree term, Tree & type)
 {
-   State state (bits);
+   std::pair <NodeRef, NodeRef> key (context.list.it, term.it);
+   SegmentMap::const_iterator hit =
+      GenerateMemoBits != 0 ? Segments.find (key) : Segments.end();
+   if (hit != Segments.end()) {
+      bits.Append (hit->second.bits, 0, hit->second.bits.size());
+      type = hit->second.type;
+      return;
+   }
+
+   size_t start = bits.size();
+   State state (&bits);
 
    state.Generate (context, term);
    state.AdvanceTo (State::WHILE);
    bits.push_back (false);      // Return...
    type = state.type;
+
+   // Rather than choose what to evict, start again when full.
+   size_t length = bits.size() - start;
+   if (SegmentBits + length > GenerateMemoBits) {
+      Segments.clear();
+      SegmentBits = 0;
+   }
+   if (length <= GenerateMemoBits) {
+      Segment & segment = Segments[key];
+      segment.bits.Append (bits, start, bits.size());
+      segment.type = type;
+      SegmentBits += length;
+   }
+}
+
+// The shortest encodings, by dynamic programming over (context, term).
+// Derive builds a term along a main line of steps, each taking an auxiliary
+// derivation or not.  What a step costs depends on where in Derive's loop the
+// one before left us (what State::Code, and with which auxiliary), so for each
+// step that can end the main line of a term, a Plan keeps the cheapest way to
+// get there and the State it leaves.  The steps are Generate()'s, on normal
+// forms, except that a weakening can come anywhere a term does not mention the
+// last item: Generate() weakens each variable and * separately, where
+// weakening a whole subterm is often shorter.
+class Shortest
+{
+public:
+   Shortest() : emittedBits (0) { }
+
+   enum Step { AXIOM, APPLY, WEAK, LAMBDA, PI, INTRO };
+
+   struct Plan;
+
+   struct Ending
+   {
+      Ending (const State & s, Step st, Tree a, const Plan * f, size_t p) :
+         state (s), step (st), aux (a), from (f), premise (p) { }
+
+      State state;              // After the step; length is the bits so far.
+      Step step;
+      Tree aux;                 // For APPLY and WEAK.
+      const Plan * from;        // The premise, and which of its endings.
+      size_t premise;
+   };
+
+   struct Plan
+   {
+      std::vector <Ending> endings;
+      size_t best;              // The ending to return from.
+      size_t length;            // Of the whole Derive call.
+      Tree type;
+      bool emitted;             // If so, its bits are in 'bits'.
+      Bits bits;
+   };
+
+   Plan & Find (const Context & c, Tree term);
+
+   // Emit the bits for a plan, as a whole Derive call.
+   void Emit (Bits & bits, Plan & plan);
+
+   // For State: the auxiliary derivation of term, pushed onto bits (if not
+   // NULL).  Returns its length.
+   size_t Aux (Bits * bits, const Context & c, Tree term, Tree & type);
+
+private:
+   static void Take (State & state, Step step, Tree aux);
+   void Extend (Plan & plan, const Plan & premise, Step step, Tree aux);
+
+   typedef std::unordered_map <std::pair <NodeRef, NodeRef>, Plan,
+                               SegmentKeyHash> PlanMap;
+   PlanMap plans;               // The Plans point into each other.
+   size_t emittedBits;
+};
+
+void Shortest::Take (State & state, Step step, Tree aux)
+{
+   switch (step) {
+   case APPLY:
+      state.DoApply (aux);
+      break;
+   case WEAK:
+      state.DoWeak (aux);
+      break;
+   case LAMBDA:
+      state.DoLambda();
+      break;
+   case PI:
+      state.DoPi();
+      break;
+   case INTRO:
+      state.DoIntro();
+      break;
+   case AXIOM:
+      break;
+   }
+}
+
+// Add the ending for taking 'step' after the premise, from whichever of its
+// endings makes that cheapest.
+void Shortest::Extend (Plan & plan, const Plan & premise, Step step, Tree aux)
+{
+   size_t best = 0;
+   State state (NULL, this);
+   for (size_t i = 0; i != premise.endings.size(); ++i) {
+      State next = premise.endings[i].state;
+      Take (next, step, aux);
+      if (i == 0 || next.length < state.length) {
+         state = next;
+         best = i;
+      }
+   }
+   plan.endings.push_back (Ending (state, step, aux, &premise, best));
+}
+
+Shortest::Plan & Shortest::Find (const Context & c, Tree term)
+{
+   std::pair <NodeRef, NodeRef> key (c.list.it, term.it);
+   PlanMap::iterator found = plans.find (key);
+   if (found != plans.end()) {
+      return found->second;
+   }
+
+   Plan plan;
+   if (c.empty() && term == 7) {
+      plan.endings.push_back (Ending (State (NULL, this), AXIOM, 0, NULL, 0));
+   }
+
+   // Weaken, if term doesn't mention the last item.
+   if (!c.empty()) {
+      Tree lowered = Subst (term, 0, 7);
+      if (Lift (lowered, 0) == term) {
+         Extend (plan, Find (c.Pop(), lowered), WEAK, c.back());
+      }
+   }
+
+   int opcode = term.Left().ToInt();
+   switch (opcode) {
+   case 0:
+   case 1:
+      // PI or LAMBDA.
+      Extend (plan, Find (c.Push (term.Right().Left()), term.Right().Right()),
+              opcode == 0 ? PI : LAMBDA, 0);
+      break;
+   case 2:
+      // APPLY.
+      Extend (plan, Find (c, term.Right().Left()), APPLY,
+              term.Right().Right());
+      break;
+   case 4:
+      // Intro, if the variable is bound.
+      if (!c.empty()) {
+         Extend (plan, Find (c.Pop(), c.back()), INTRO, 0);
+      }
+      break;
+   default:
+      break;
+   }
+   assert (!plan.endings.empty());
+
+   plan.best = 0;
+   for (size_t i = 0; i != plan.endings.size(); ++i) {
+      State state = plan.endings[i].state;
+      state.AdvanceTo (State::WHILE);
+      state.Push (false);       // Return...
+      if (i == 0 || state.length < plan.length) {
+         plan.best = i;
+         plan.length = state.length;
+      }
+      assert (state.type == plan.endings[0].state.type);
+   }
+   plan.type = plan.endings[0].state.type;
+   plan.emitted = false;
+
+   return plans.insert (std::make_pair (key, plan)).first->second;
+}
+
+void Shortest::Emit (Bits & bits, Plan & plan)
+{
+   if (plan.emitted) {
+      bits.Append (plan.bits, 0, plan.bits.size());
+      return;
+   }
+
+   std::vector <const Ending *> steps;
+   for (const Ending * e = &plan.endings[plan.best];
+        e->step != AXIOM; e = &e->from->endings[e->premise]) {
+      steps.push_back (e);
+   }
+
+   size_t start = bits.size();
+   State state (&bits, this);
+   for (size_t i = steps.size(); i-- != 0; ) {
+      Take (state, steps[i]->step, steps[i]->aux);
+   }
+   state.AdvanceTo (State::WHILE);
+   state.Push (false);
+   assert (state.length == plan.length);
+
+   // The same auxiliaries come again and again, as with Generate().
+   if (emittedBits + plan.length <= GenerateMemoBits) {
+      plan.bits.Append (bits, start, bits.size());
+      plan.emitted = true;
+      emittedBits += plan.length;
+   }
+}
+
+size_t Shortest::Aux (Bits * bits, const Context & c, Tree term, Tree & type)
+{
+   Plan & plan = Find (c, term);
+   type = plan.type;
+   if (bits != NULL) {
+      Emit (*bits, plan);
+   }
+   return plan.length;
+}
+
+void GenerateShortest (Bits & bits, const Context & context,
+                       Tree term, Tree & type)
+{
+   Shortest shortest;
+   Tree normal = Normalise (term);
+   Shortest::Plan & plan = shortest.Find (context, normal);
+
+   // The plans are on the normal form, which can be much bigger than term.
+   if (!(normal == term)) {
+      Bits generated;
+      Generate (generated, context, term, type);
+      if (generated.size() < plan.length) {
+         bits.Append (generated, 0, generated.size());
+         return;
+      }
+   }
+
+   type = plan.type;
+   shortest.Emit (bits, plan);
+}
+
+Tree BitsToTree (const Bits & bits)
+{
+   // Walk the 1 bits from the top down.  When we find one, the previous
+   // (higher) one becomes a node, now that we know the run of zeros below it.
+   const std::vector <uint64_t> & words = bits.Words();
+   Tree result = 0;
+   bool pending = false;
+   size_t above = 0;            // The position of the pending 1 bit.
+   for (size_t w = words.size(); w-- != 0; ) {
+      uint64_t word = words[w];
+      while (word != 0) {
+         int top = 63 - __builtin_clzll (word);
+         word &= ~(uint64_t (1) << top);
+         size_t position = w * 64 + top;
+         if (pending) {
+            assert (above - position - 1 <= INT_MAX);
+            result = Pair (result, int (above - position - 1));
+         }
+         pending = true;
+         above = position;
+      }
+   }
+   if (pending) {
+      assert (above <= INT_MAX);
+      result = Pair (result, int (above));
+   }
+   return result;
+}
+
+void TreeToBits (Bits & bits, Tree t)
+{
+   for (; !t.IsNull(); t = t.Left()) {
+      for (int zeros = t.Right().ToInt(); zeros != 0; --zeros) {
+         bits.push_back (false);
+      }
+      bits.push_back (true);
+   }
 }
 
 void State::Generate (const Context & c, Tree t)
@@ -74,9 +408,7 @@ void State::Generate (const Context & c, Tree t)
    case 0:
    case 1: {
       // PI or LAMBDA.
-      Context newContext = c;
-      newContext.push_back (t.Right().Left());
-      Generate (newContext, t.Right().Right());
+      Generate (c.Push (t.Right().Left()), t.Right().Right());
       if (opcode == 0) {
          DoPi();
       }
@@ -97,9 +429,7 @@ void State::Generate (const Context & c, Tree t)
       if (c.empty()) {
          break;
       }
-      Context newContext = c;
-      newContext.pop_back();
-      Generate (newContext, t);
+      Generate (c.Pop(), t);
       DoWeak (c.back());
       break;
    }
@@ -107,16 +437,14 @@ void State::Generate (const Context & c, Tree t)
       assert ((opcode & 1) == 0);
       size_t var = (opcode >> 1) - 2;
       assert (var < c.size());
-      Context newContext = c;
-      newContext.pop_back();
       if (var == 0) {
          // Intro...
-         Generate (newContext, c.back());
+         Generate (c.Pop(), c.back());
          DoIntro();
       }
       else {
          // Weak...
-         Generate (newContext, Pair (4 + 2 * (var - 1), 0));
+         Generate (c.Pop(), Pair (4 + 2 * (var - 1), 0));
          DoWeak (c.back());
       }
       break;
@@ -124,19 +452,31 @@ void State::Generate (const Context & c, Tree t)
    }
 }
 
+// Contexts are compared again and again as Generate() advances, so the
+// results are memoised.
+static MemoTable ContextMemo ("Context");
+static bool ContextMemoConfigured = (ContextMemo.Configure (1 << 12), true);
+
 bool NormalisedEquals (const Context & a, const Context & b)
 {
-   if (a.size() != b.size()) {
-      return false;
+   MemoKey key (a.list, b.list);
+   Tree result;
+   if (ContextMemo.Lookup (key, result)) {
+      return result == 1;
    }
 
-   for (size_t i = 0; i != a.size(); ++i) {
-      if (!::NormalisedEquals (a[i], b[i])) {
-         return false;
-      }
+   // Walk down both until they meet, which they do at the latest at the empty
+   // context.
+   Tree x = a.list, y = b.list;
+   while (!(x == y) && !x.IsNull() && !y.IsNull()
+          && ::NormalisedEquals (x.Left(), y.Left())) {
+      x = x.Right();
+      y = y.Right();
    }
+   bool equal = x == y;
 
-   return true;
+   ContextMemo.Insert (key, equal);
+   return equal;
 }
 
 // Advance state while doing nothing.
@@ -146,14 +486,14 @@ void State::Advance()
    case WHILE:
 
       // Loop!
-      bits.push_back (true);
+      Push (true);
       code = AUXILARY;
       break;
 
    case AUXILARY:
 
       // Trivial auxilary.
-      bits.push_back (false);
+      Push (false);
       auxTerm = Pair (3,0);
       auxType = Pair (3,1);
       auxContext.clear();
@@ -176,7 +516,7 @@ void State::Advance()
       Tree whType = WeakHeadNormalise (type);
       if (whType.Left() == 0 &&
           NormalisedEquals (whType.Right().Left(), auxType)) {
-         bits.push_back (false);
+         Push (false);
       }
       code = WEAK;
       break;
@@ -184,20 +524,20 @@ void State::Advance()
 
    case WEAK:
 
-      bits.push_back (false);
+      Push (false);
       code = CONTEXT;
       break;
 
    case CONTEXT:
 
       if (!context.empty()) {
-         bits.push_back (false);
+         Push (false);
       }
       code = INTRO;
       break;
 
    case INTRO:
-      bits.push_back (false);
+      Push (false);
       code = WHILE;
       break;
    }
@@ -217,7 +557,14 @@ void State::AdvanceTo (Code newCode, Tree newAuxTerm)
           auxTerm != newAuxTerm) {
       if (code == AUXILARY) {
          // Generate the auxilary we want...
-         ::Generate (bits, context, newAuxTerm, auxType);
+         if (shortest != NULL) {
+            length += shortest->Aux (bits, context, newAuxTerm, auxType);
+         }
+         else {
+            size_t before = bits->size();
+            ::Generate (*bits, context, newAuxTerm, auxType);
+            length += bits->size() - before;
+         }
          auxContext = context;
          auxTerm = newAuxTerm;
          code = BINARY;
@@ -236,7 +583,7 @@ void State::DoApply (Tree newAuxTerm)
    assert (whType.Left() == 0);
    assert (::NormalisedEquals (whType.Right().Left(), auxType));
 
-   bits.push_back (true);
+   Push (true);
    term = Pair (2, Pair (term, auxTerm));
    type = Subst (whType.Right().Right(), 0, auxTerm);
 
@@ -248,7 +595,7 @@ void State::DoWeak (Tree newAuxTerm)
    AdvanceTo (WEAK, newAuxTerm);
 
    assert (auxType.Left() == 3);
-   bits.push_back (true);
+   Push (true);
    context.push_back (auxTerm);
    term = Lift (term, 0);
    type = Lift (type, 0);
@@ -261,8 +608,8 @@ void State::DoLambda()
 
    assert (!context.empty());
 
-   bits.push_back (true);
-   bits.push_back (true);
+   Push (true);
+   Push (true);
 
    term = Pair (1, Pair (context.back(), term));
    type = Pair (0, Pair (context.back(), type));
@@ -277,8 +624,8 @@ void State::DoPi()
 
    assert (!context.empty());
    assert (type.Left() == 3);
-   bits.push_back (true);
-   bits.push_back (false);
+   Push (true);
+   Push (false);
 
    term = Pair (0, Pair (context.back(), term));
    context.pop_back();
@@ -292,7 +639,7 @@ void State::DoIntro()
 
    assert (type.Left() == 3);
 
-   bits.push_back (true);
+   Push (true);
    context.push_back (term);
    type = Lift (term, 0);
    term = Pair (4, 0);
@@ -9,14 +9,147 @@
 
 #include "parse.hh"
 
+#include <stddef.h>
+#include <stdint.h>
 #include <vector>
 
-typedef std::vector <Tree> Context;
-typedef std::vector<bool> Bits;
+// A context, as pure.c has them: the cons list Pair (A, Gamma) for Gamma,A,
+// with 0 empty.  As the list is interned, pushing and popping make no copies,
+// and equal contexts are the same Tree.
+class Context
+{
+public:
+   Context() : list (0) { }
+   explicit Context (Tree l) : list (l) { }
 
+   bool empty() const { return list.IsNull(); }
+   Tree back() const { return list.Left(); }
+
+   // O(n).
+   size_t size() const
+      {
+         size_t n = 0;
+         for (Tree t = list; !t.IsNull(); t = t.Right()) {
+            ++n;
+         }
+         return n;
+      }
+
+   Context Push (Tree item) const { return Context (Pair (item, list)); }
+   Context Pop() const { return Context (list.Right()); }
+
+   void push_back (Tree item) { list = Pair (item, list); }
+   void pop_back() { list = list.Right(); }
+   void clear() { list = 0; }
+
+   bool operator== (const Context & other) const
+      { return list == other.list; }
+   bool operator!= (const Context & other) const
+      { return !(list == other.list); }
+
+   Tree list;
+};
+
+// A bitstream, packed 64 bits to a word.  Bit i is the i'th bit pushed, and
+// is bit i of the number Derive() reads; i.e., the first bit pushed is the
+// first bit Derive consumes.
+class Bits
+{
+public:
+   Bits() : count (0) { }
+
+   void push_back (bool bit)
+      {
+         if (count % 64 == 0) {
+            words.push_back (0);
+         }
+         if (bit) {
+            words.back() |= uint64_t (1) << count % 64;
+         }
+         ++count;
+      }
+
+   bool operator[] (size_t i) const
+      {
+         return words[i / 64] >> i % 64 & 1;
+      }
+
+   size_t size() const { return count; }
+
+   // Append bits [first, end) of 'from', a word at a time.
+   void Append (const Bits & from, size_t first, size_t end)
+      {
+         for (size_t i = first; i < end; i += 64) {
+            unsigned n = end - i < 64 ? end - i : 64;
+            PushBits (from.Get (i, n), n);
+         }
+      }
+
+   // Empty, but keep the storage.
+   void clear()
+      {
+         words.clear();
+         count = 0;
+      }
+
+   const std::vector <uint64_t> & Words() const { return words; }
+
+private:
+   // Bits [i, i + n) as a number, for n <= 64.
+   uint64_t Get (size_t i, unsigned n) const
+      {
+         size_t w = i / 64;
+         unsigned offset = i % 64;
+         uint64_t value = words[w] >> offset;
+         if (offset != 0 && offset + n > 64) {
+            value |= words[w + 1] << (64 - offset);
+         }
+         return n == 64 ? value : value & ((uint64_t (1) << n) - 1);
+      }
+
+   // Push the n <= 64 bits of 'value', low bit first.
+   void PushBits (uint64_t value, unsigned n)
+      {
+         unsigned offset = count % 64;
+         if (offset == 0) {
+            words.push_back (0);
+         }
+         words.back() |= value << offset;
+         if (offset + n > 64) {
+            words.push_back (value >> (64 - offset));
+         }
+         count += n;
+      }
+
+   std::vector <uint64_t> words;
+   size_t count;
+};
+
+// Build the Tree for the number with the given bits, in time linear in the
+// number of bits.  Each node's right child is a run of zeros, so we never
+// need to Double() or Increment().
+Tree BitsToTree (const Bits & bits);
+
+// The inverse: the bits of the number t, without leading zeros.
+void TreeToBits (Bits & bits, Tree t);
+
+// Append the bits that Derive turns into the judgment context |- term : type,
+// and set 'type'.  The results are memoised, in up to GenerateMemoBits bits
+// (zero to turn it off).
 void Generate (Bits & bits,
                const Context & context,
                Tree term,
                Tree & type);
 
+extern size_t GenerateMemoBits;
+
+// As Generate(), but with the fewest bits we can find: the shortest encoding
+// of the normal form of term, by dynamic programming over the ways Derive can
+// build it (see Shortest in bitstream.cc), or Generate()'s if that is
+// shorter.
+void GenerateShortest (Bits & bits,
+                       const Context & context,
+                       Tree term,
+                       Tree & type);
+
 #endif
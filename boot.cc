@@ -1,27 +1,307 @@
 // Calculate the height of the exponential tower given by the initial bootstrap.
 
-// Compile pure.c with the recursive search enabled.
+// Options:
+//  --memo SIZE           Memoise Subst and Apply in tables of SIZE entries.
+//  --memo-ways N         Associativity of the memo tables (default 4).
+//  --memo-policy lru|fifo
+//  --derive-memo SIZE    Memoise Derive per bitstream, in SIZE entries.
+//  --iterative           Use DeriveIterative rather than recursing.
+//  --threads N           Use DeriveParallel on N threads (needs -DTHREADS).
+//  --chunk N             Values per chunk for --threads (default 1).
+//  --stages N            Apply Derive N times, as pure.c's main does 5 times
+//                        (default 1; any more will not finish).
+//  --gc                  Collect garbage after each stage.
+//  --gc-threshold N      With --iterative, also collect whenever there are
+//                        more than N nodes.
+//  --no-skip-closed      Turn off the Subst shortcuts in tree.cc, to compare.
+//  --no-shift-kernel
+//  --no-machine          Reduce with pure.c's Subst and Apply rather than the
+//                        Krivine machine in machine.hh, to compare.
+//  --save FILE           Write the final tree to FILE as a snapshot.
+//  --load FILE           Start from the tree in snapshot FILE rather than 99,
+//                        e.g., one written by --save; then --stages defaults
+//                        to 0.
+//  --checkpoint FILE     Run each stage with DeriveFrom, --chunk values at a
+//                        time, appending the position reached to FILE every
+//                        so often, and on SIGINT or SIGTERM, which stop.
+//  --checkpoint-every S  Seconds between checkpoints (default 60; 0 for after
+//                        every chunk).
+//  --resume              Carry on from the last checkpoint in FILE.  Give the
+//                        same other options as the run that wrote it.
+//  --stats               Report what each stage did, and the total with the
+//                        peak nodes and RSS.  The counters need -DTREE_STATS.
+//  --stats-every S       Also report every S seconds, to stderr.  This needs
+//                        -DTREE_STATS.
+
+// Compile pure.c with the recursive search enabled.  DESCENDS says so to
+// tree.cc, which can't tell from DESCEND itself.
 #define DESCEND xx
+#define DESCENDS true
 
 #include "tree.cc"
+#include "dag.hh"
+#include "intern.hh"
+#include "snapshot.hh"
+#include "stats.hh"
+
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
-int height (Tree h)
+static volatile sig_atomic_t Stop;
+
+static void OnSignal (int)
 {
-   if (h.IsNull()) {
-      return 0;
-   }
+   Stop = 1;
+}
 
-   int left = height (h.Left());
-   int right = height (h.Right()) + 1;
+// The state for --checkpoint.  A checkpoint's roots are the stage, the tree
+// it is deriving from, the next value, and accumulate.
+struct Checkpointer
+{
+   SnapshotWriter writer;
+   time_t every;
+   time_t last;
+   unsigned stage;
+   RootedTree xx;
+   bool stopped;
+   bool failed;
+};
 
-   return left > right ? left : right;
+static bool Progress (Tree next, Tree accumulated, void * data)
+{
+   Checkpointer & c = *static_cast <Checkpointer *> (data);
+   time_t now = time (NULL);
+   if (Stop || now - c.last >= c.every) {
+      std::vector <Tree> roots;
+      roots.push_back (c.stage);
+      roots.push_back (c.xx);
+      roots.push_back (next);
+      roots.push_back (accumulated);
+      if (!c.writer.Write (roots)) {
+         c.failed = true;
+         return false;
+      }
+      c.last = now;
+   }
+   c.stopped = Stop;
+   return !Stop;
 }
 
-int main()
+int main (int argc, const char * const * argv)
 {
+   size_t memoSize = 0;
+   unsigned memoWays = 4;
+   MemoTable::Policy memoPolicy = MemoTable::LRU;
+   size_t deriveMemoSize = 0;
+   bool iterative = false;
+   unsigned threads = 0;
+   size_t chunk = 1;
+   unsigned stages = 1;
+   bool stagesGiven = false;
+   bool gc = false;
+   const char * save = NULL;
+   const char * load = NULL;
+   const char * checkpoint = NULL;
+   time_t checkpointEvery = 60;
+   bool resume = false;
+   bool stats = false;
+
+   for (int i = 1; i != argc; ++i) {
+      if (i + 1 != argc && strcmp (argv[i], "--memo") == 0) {
+         memoSize = strtoul (argv[++i], NULL, 0);
+      }
+      else if (i + 1 != argc && strcmp (argv[i], "--memo-ways") == 0) {
+         memoWays = strtoul (argv[++i], NULL, 0);
+      }
+      else if (i + 1 != argc && strcmp (argv[i], "--memo-policy") == 0) {
+         ++i;
+         memoPolicy = strcmp (argv[i], "fifo") == 0
+            ? MemoTable::FIFO : MemoTable::LRU;
+      }
+      else if (i + 1 != argc && strcmp (argv[i], "--derive-memo") == 0) {
+         deriveMemoSize = strtoul (argv[++i], NULL, 0);
+      }
+      else if (strcmp (argv[i], "--iterative") == 0) {
+         iterative = true;
+      }
+      else if (i + 1 != argc && strcmp (argv[i], "--threads") == 0) {
+         threads = strtoul (argv[++i], NULL, 0);
+      }
+      else if (i + 1 != argc && strcmp (argv[i], "--chunk") == 0) {
+         chunk = strtoul (argv[++i], NULL, 0);
+      }
+      else if (i + 1 != argc && strcmp (argv[i], "--stages") == 0) {
+         stages = strtoul (argv[++i], NULL, 0);
+         stagesGiven = true;
+      }
+      else if (strcmp (argv[i], "--gc") == 0) {
+         gc = true;
+      }
+      else if (i + 1 != argc && strcmp (argv[i], "--gc-threshold") == 0) {
+         CollectThreshold = strtoul (argv[++i], NULL, 0);
+      }
+      else if (strcmp (argv[i], "--no-skip-closed") == 0) {
+         SkipClosed = false;
+      }
+      else if (strcmp (argv[i], "--no-shift-kernel") == 0) {
+         ShiftKernel = false;
+      }
+      else if (strcmp (argv[i], "--no-machine") == 0) {
+         KrivineMachine = false;
+      }
+      else if (i + 1 != argc && strcmp (argv[i], "--save") == 0) {
+         save = argv[++i];
+      }
+      else if (i + 1 != argc && strcmp (argv[i], "--load") == 0) {
+         load = argv[++i];
+      }
+      else if (i + 1 != argc && strcmp (argv[i], "--checkpoint") == 0) {
+         checkpoint = argv[++i];
+      }
+      else if (i + 1 != argc
+               && strcmp (argv[i], "--checkpoint-every") == 0) {
+         checkpointEvery = strtoul (argv[++i], NULL, 0);
+      }
+      else if (strcmp (argv[i], "--resume") == 0) {
+         resume = true;
+      }
+      else if (strcmp (argv[i], "--stats") == 0) {
+         stats = true;
+      }
+      else if (i + 1 != argc && strcmp (argv[i], "--stats-every") == 0) {
+#ifndef TREE_STATS
+         std::cerr << "--stats-every needs -DTREE_STATS\n";
+         return 1;
+#endif
+         StartStats (strtoul (argv[++i], NULL, 0));
+      }
+      else {
+         std::cerr << "Usage: " << argv[0] << " [--memo SIZE]"
+                   << " [--memo-ways N] [--memo-policy lru|fifo]"
+                   << " [--derive-memo SIZE] [--iterative]"
+                   << " [--threads N] [--chunk N]"
+                   << " [--stages N] [--gc] [--gc-threshold N]"
+                   << " [--no-skip-closed] [--no-shift-kernel]"
+                   << " [--no-machine]"
+                   << " [--save FILE] [--load FILE]"
+                   << " [--checkpoint FILE [--checkpoint-every S] [--resume]]"
+                   << " [--stats] [--stats-every S]\n";
+         return 1;
+      }
+   }
+   if (resume && checkpoint == NULL) {
+      std::cerr << "--resume needs --checkpoint FILE\n";
+      return 1;
+   }
+
+   if (memoSize != 0 && memoWays != 0) {
+      SubstMemo.Configure (memoSize, memoWays, memoPolicy);
+      ApplyMemo.Configure (memoSize, memoWays, memoPolicy);
+   }
+   if (deriveMemoSize != 0 && memoWays != 0) {
+      DeriveMemo.Configure (deriveMemoSize, memoWays, memoPolicy);
+   }
+
+   RootedTree bootstrap = Tree (99);
+   if (load != NULL) {
+      std::vector <Tree> roots;
+      if (!LoadSnapshot (load, roots) || roots.size() != 1) {
+         std::cerr << "Cannot load snapshot " << load << '\n';
+         return 1;
+      }
+      bootstrap = roots[0];
+      if (!stagesGiven) {
+         stages = 0;
+      }
+   }
+
+   unsigned first = 0;
+   RootedTree resumeNext = Tree (0);
+   RootedTree resumeItems = accumulate;
+   if (resume) {
+      std::vector <Tree> roots;
+      if (!LoadSnapshot (checkpoint, roots) || roots.size() != 4) {
+         std::cerr << "Cannot load checkpoint " << checkpoint << '\n';
+         return 1;
+      }
+      first = roots[0].ToInt();
+      bootstrap = roots[1];
+      resumeNext = roots[2];
+      resumeItems = roots[3];
+   }
+
+   Checkpointer checkpointer;
+   if (checkpoint != NULL) {
+      if (!checkpointer.writer.Open (checkpoint)) {
+         std::cerr << "Cannot write checkpoint " << checkpoint << '\n';
+         return 1;
+      }
+      checkpointer.every = checkpointEvery;
+      checkpointer.last = time (NULL);
+      checkpointer.stopped = false;
+      checkpointer.failed = false;
+      signal (SIGINT, OnSignal);
+      signal (SIGTERM, OnSignal);
+   }
+
+   for (unsigned stage = first; stage < stages; ++stage) {
+      TreeStats before = Stats;
+      if (checkpoint != NULL) {
+         checkpointer.stage = stage;
+         checkpointer.xx = bootstrap;
+         bootstrap = DeriveFrom (bootstrap, resumeNext, resumeItems, chunk,
+                                 Progress, &checkpointer);
+         if (checkpointer.failed) {
+            std::cerr << "Cannot write checkpoint " << checkpoint << '\n';
+            return 1;
+         }
+         if (checkpointer.stopped) {
+            std::cerr << "Stopped; carry on with --resume.\n";
+            return 2;
+         }
+         resumeNext = 0;
+         resumeItems = bootstrap;
+      }
+      else {
+         bootstrap = threads != 0 ? DeriveParallel (bootstrap, threads, chunk)
+            : iterative ? DeriveIterative (bootstrap) : Derive (bootstrap);
+      }
+      if (gc) {
+         CollectedNodes += Collect();
+      }
+      if (stats) {
+         std::cout << "Stage " << stage + 1 << ":\n";
+         ReportStats (std::cout, Stats - before);
+      }
+   }
+
+   if (save != NULL
+       && !SaveSnapshot (save, std::vector <Tree> (1, bootstrap))) {
+      std::cerr << "Cannot save snapshot " << save << '\n';
+      return 1;
+   }
+
    // We subtract 1 to take account of the fact that 2^(2^(2^0)) = 2^2 etc...
    std::cout << "The bootstrap tower has height: "
-             << height (Derive (99)) -1 << std::endl;
+             << AnalyseDag (bootstrap).tower - 1 << std::endl;
+
+   if (SubstMemo.Enabled()) {
+      SubstMemo.Report (std::cout);
+      ApplyMemo.Report (std::cout);
+   }
+   if (DeriveMemo.Enabled()) {
+      ReportDeriveMemo (std::cout);
+   }
+   if (gc || CollectThreshold != 0) {
+      std::cout << "Nodes: " << NodeCount() << " live, "
+                << CollectedNodes << " freed by collections.\n";
+   }
+   if (stats) {
+      std::cout << "Total:\n";
+      ReportStats (std::cout, Stats);
+      ReportPeak (std::cout, Stats);
+   }
    return 0;
 }
-
@@ -0,0 +1,74 @@
+
+// Memoised passes over the distinct nodes of a Tree.
+
+#include "dag.hh"
+
+#include <math.h>
+#include <unordered_map>
+#include <vector>
+
+// The results for one node.
+struct NodeStats
+{
+   unsigned long height;
+   double log2Leaves;
+   unsigned long long tower;
+};
+
+// log2 (2^a + 2^b), without overflow.
+static double Log2Sum (double a, double b)
+{
+   double hi = a > b ? a : b;
+   double lo = a > b ? b : a;
+   return hi + log2 (1 + exp2 (lo - hi));
+}
+
+DagStats AnalyseDag (Tree root)
+{
+   std::unordered_map <NodeRef, NodeStats> done;
+   const NodeStats null = { 0, 0, 0 };
+   done[NodeRef()] = null;
+
+   // A post-order walk, with an explicit stack as the DAG can be deep.  A node
+   // is pushed, and then pushed again above its children; it is done when it
+   // is popped with its children done.
+   std::vector <Tree> stack (1, root);
+   while (!stack.empty()) {
+      Tree t = stack.back();
+      if (done.count (t.it) != 0) {
+         stack.pop_back();
+         continue;
+      }
+
+      std::unordered_map <NodeRef, NodeStats>::const_iterator l =
+         done.find (t.Left().it);
+      std::unordered_map <NodeRef, NodeStats>::const_iterator r =
+         done.find (t.Right().it);
+      if (l == done.end() || r == done.end()) {
+         if (l == done.end()) {
+            stack.push_back (t.Left());
+         }
+         if (r == done.end()) {
+            stack.push_back (t.Right());
+         }
+         continue;
+      }
+
+      NodeStats s;
+      s.height = 1 + (l->second.height > r->second.height
+                      ? l->second.height : r->second.height);
+      s.log2Leaves = Log2Sum (l->second.log2Leaves, r->second.log2Leaves);
+      s.tower = l->second.tower > r->second.tower + 1
+         ? l->second.tower : r->second.tower + 1;
+      done[t.it] = s;
+      stack.pop_back();
+   }
+
+   const NodeStats & s = done[root.it];
+   DagStats result;
+   result.nodes = done.size() - 1;
+   result.height = s.height;
+   result.log2Leaves = s.log2Leaves;
+   result.tower = s.tower;
+   return result;
+}
@@ -0,0 +1,23 @@
+#ifndef DAG_HH_
+#define DAG_HH_
+
+// Statistics of a Tree viewed as the DAG it really is.  Walking a Tree
+// recursively visits shared nodes once per path to them, which for the output
+// of Derive is exponentially often; AnalyseDag() visits each distinct node
+// once, so takes time linear in the number of them.
+
+#include "tree.hh"
+
+struct DagStats
+{
+   size_t nodes;                // Distinct nodes, not counting null.
+   unsigned long height;        // Nodes on the longest path down to null.
+   double log2Leaves;           // log2 of the nulls in the unfolded tree,
+                                // which is one more than its nodes.
+   unsigned long long tower;    // max (tower (left), tower (right) + 1); less
+                                // one, the height of the tower of 2s.
+};
+
+DagStats AnalyseDag (Tree root);
+
+#endif
@@ -0,0 +1,58 @@
+// Report the shape of the DAG that Derive returns: how many distinct nodes,
+// how high, how big it would be unfolded into a tree, and the height of the
+// tower of 2s that boot reports.
+
+// Usage: dagstat [--stages N] [--iterative] [BITSTREAM]
+// Derives from BITSTREAM (default 99), N times over (default 1), reporting
+// after each stage.
+
+// Compile pure.c with the recursive search enabled.  DESCENDS says so to
+// tree.cc, which can't tell from DESCEND itself.
+#define DESCEND xx
+#define DESCENDS true
+
+#include "tree.cc"
+#include "dag.hh"
+#include "intern.hh"
+
+#include <stdlib.h>
+#include <string.h>
+
+int main (int argc, const char * const * argv)
+{
+   int start = 99;
+   unsigned stages = 1;
+   bool iterative = false;
+
+   for (int i = 1; i != argc; ++i) {
+      if (i + 1 != argc && strcmp (argv[i], "--stages") == 0) {
+         stages = strtoul (argv[++i], NULL, 0);
+      }
+      else if (strcmp (argv[i], "--iterative") == 0) {
+         iterative = true;
+      }
+      else if (argv[i][0] != '-') {
+         start = strtoul (argv[i], NULL, 0);
+      }
+      else {
+         std::cerr << "Usage: " << argv[0]
+                   << " [--stages N] [--iterative] [BITSTREAM]\n";
+         return 1;
+      }
+   }
+
+   Tree result = start;
+   for (unsigned stage = 1; stage <= stages; ++stage) {
+      result = iterative ? DeriveIterative (result) : Derive (result);
+
+      DagStats stats = AnalyseDag (result);
+      std::cout << "Stage " << stage << ":\n"
+                << "  Distinct nodes:  " << stats.nodes << "\n"
+                << "  DAG height:      " << stats.height << "\n"
+                << "  Unfolded size:   2^" << stats.log2Leaves << " - 1\n"
+                << "  Tower height:    " << stats.tower - 1 << "\n";
+   }
+
+   std::cout << "Nodes interned:    " << NodeCount() << std::endl;
+   return 0;
+}
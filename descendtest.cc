@@ -0,0 +1,119 @@
+// Checks of the Derive drivers with pure.c's recursive search, as boot and
+// dagstat compile it, which treetest does not: the recursive Derive and
+// DeriveIterative, DeriveParallel, and DeriveFrom stopped and resumed.  Also
+// BitCursor, which the recursive search takes xx - 1 of.
+
+// Compile pure.c with the recursive search enabled.  DESCENDS says so to
+// tree.cc, which can't tell from DESCEND itself.
+#define DESCEND xx
+#define DESCENDS true
+
+#include "tree.cc"
+
+#include <vector>
+
+// Read up to 'steps' bits of t through a BitCursor, checking it against
+// halving t itself.  If t is small, also check xx - 1 at each step.
+static void CheckCursor (Tree t, int steps, bool small)
+{
+   BitCursor cursor (t);
+   for (Tree rest = t; steps-- != 0; rest = rest.Halve()) {
+      assert (Tree (cursor) == rest);
+      assert (cursor.IsNull() == rest.IsNull());
+      assert (cursor % 2 == rest % 2);
+      if (rest.IsNull()) {
+         break;
+      }
+      if (small) {
+         assert ((cursor - 1 ? true : false) == !(rest == 1));
+         assert (Tree (cursor - 1) == rest.Decrement());
+      }
+      cursor /= 2;
+   }
+}
+
+// Each driver starts from an empty accumulate, so that their lists compare.
+static Tree Recursive (Tree xx)
+{
+   accumulate = 0;
+   return Derive (xx);
+}
+
+static Tree Iterative (Tree xx)
+{
+   accumulate = 0;
+   return DeriveIterative (xx);
+}
+
+static Tree Parallel (Tree xx, unsigned threads, size_t chunk)
+{
+   accumulate = 0;
+   return DeriveParallel (xx, threads, chunk);
+}
+
+// A DeriveProgress that stops after 'chunks' chunks, keeping where to resume.
+struct Stopper
+{
+   unsigned chunks;
+   Tree next;
+   Tree accumulated;
+};
+
+static bool Stop (Tree next, Tree accumulated, void * data)
+{
+   Stopper & stopper = *static_cast <Stopper *> (data);
+   stopper.next = next;
+   stopper.accumulated = accumulated;
+   return --stopper.chunks != 0;
+}
+
+// DeriveFrom (xx), stopped after 'stop' chunks and resumed from there.
+static Tree Resumed (Tree xx, size_t chunk, unsigned stop)
+{
+   Stopper stopper;
+   stopper.chunks = stop;
+   Tree result = DeriveFrom (xx, 0, 0, chunk, Stop, &stopper);
+   if (stopper.chunks != 0) {
+      return result;            // Finished before it was stopped.
+   }
+   accumulate = Pair (7, 7);    // Resuming must not depend on accumulate.
+   return DeriveFrom (xx, stopper.next, stopper.accumulated, chunk);
+}
+
+int main()
+{
+   // BitCursor, on small numbers, and on runs of zeros too long to count in
+   // an int or at all, where it only reads the first few.
+   for (int i = 0; i != 5000; ++i) {
+      CheckCursor (i, -1, true);
+   }
+   CheckCursor (Pair (12345, 40), -1, false);
+   CheckCursor (Pair (5, Pair (1, 40)), 100, false);
+   CheckCursor (Pair (5, Pair (1, 70)), 100, false);
+   CheckCursor (Pair (Pair (3, Pair (1, 70)), 3), 100, false);
+
+   // Up to 99, which boot starts from; the cost grows steeply beyond.
+   const int values = 100;
+   std::vector <Tree> plain;
+   for (int i = 0; i != values; ++i) {
+      plain.push_back (Recursive (i));
+   }
+
+   // The drivers push the same items as the recursive Derive, whatever the
+   // chunking.
+   for (int i = 0; i != values; ++i) {
+      assert (Iterative (i) == plain[i]);
+      assert (Parallel (i, 4, 1) == plain[i]);
+      assert (Parallel (i, 3, 7) == plain[i]);
+      assert (Parallel (i, 2, values) == plain[i]);
+   }
+
+   // So does DeriveFrom, in one go or stopped part way and resumed.
+   for (int i = 0; i != values; ++i) {
+      assert (DeriveFrom (i, 0, 0, 5) == plain[i]);
+      assert (Resumed (i, 1, 1) == plain[i]);
+      assert (Resumed (i, 4, 3) == plain[i]);
+   }
+
+   return 0;
+}
@@ -0,0 +1,368 @@
+
+// Reduction with explicit substitutions.
+
+#include "esubst.hh"
+
+#include <deque>
+
+struct Sub;
+
+// The term 'term' under the substitution 'sub'.
+struct Closure
+{
+   Tree term;
+   const Sub * sub;
+};
+
+// Substitutions map variable indices to closures.
+struct Sub
+{
+   enum Kind {
+      SHIFT,                    // VAR i to VAR i + n.
+      CONS,                     // VAR 0 to head, VAR i + 1 to rest (VAR i).
+      LIFT,                     // Under a binder: VAR 0 to itself, VAR i + 1
+                                // to rest (VAR i) shifted by 1.
+      THEN                      // rest (VAR i) shifted by n.
+   };
+
+   Kind kind;
+   long n;
+   Closure head;
+   const Sub * rest;
+};
+
+// A closure reduced to weak head normal form.
+struct Head
+{
+   enum Kind {
+      PI,                       // The same numbers as the opcodes.
+      LAMBDA,
+      APPLY,                    // Stuck: function is not a LAMBDA.
+      VAR,
+      CONSTANT                  // STAR or BOX.
+   };
+
+   Kind kind;
+
+   // PI and LAMBDA: the domain, and the body, whose substitution is to be
+   // lifted, or extended with an argument.
+   Closure domain;
+   Closure body;
+
+   // APPLY.
+   const Head * function;
+   Closure argument;
+
+   long index;                  // VAR.
+   Tree constant;               // CONSTANT.
+};
+
+// Owns the substitutions and heads for one reduction.
+class Reducer
+{
+public:
+   Reducer();
+
+   Closure Plain (Tree t) const
+      {
+         Closure c = { t, identity };
+         return c;
+      }
+
+   const Sub * Cons (Closure head, const Sub * rest);
+
+   const Head * Whnf (Closure c);
+   Tree Normalise (Closure c) { return ReadBack (Whnf (c)); }
+   Tree ReadBack (const Head * h);
+   bool Equal (Closure a, Closure b);
+   bool Equal (const Head * a, const Head * b);
+
+   // Push the substitution all the way in, without reducing.
+   Tree Materialise (Closure c);
+   Tree Materialise (const Head * h);
+
+private:
+   Sub * NewSub (Sub::Kind kind, long n, const Sub * rest);
+   const Sub * Lift (const Sub * s);
+   Closure Shifted (Closure c, long n);
+   Closure Lookup (long i, const Sub * s);
+   Closure UnderBinder (const Head * binder);
+   Head * NewHead (Head::Kind kind);
+
+   std::deque <Sub> subs;
+   std::deque <Head> heads;
+   const Sub * identity;
+};
+
+static Tree Var (long index)
+{
+   return Pair (int (4 + 2 * index), 0);
+}
+
+Reducer::Reducer()
+{
+   identity = NewSub (Sub::SHIFT, 0, NULL);
+}
+
+Sub * Reducer::NewSub (Sub::Kind kind, long n, const Sub * rest)
+{
+   subs.resize (subs.size() + 1);
+   Sub & s = subs.back();
+   s.kind = kind;
+   s.n = n;
+   s.rest = rest;
+   return &s;
+}
+
+const Sub * Reducer::Cons (Closure head, const Sub * rest)
+{
+   Sub * s = NewSub (Sub::CONS, 0, rest);
+   s->head = head;
+   return s;
+}
+
+const Sub * Reducer::Lift (const Sub * s)
+{
+   return s == identity ? s : NewSub (Sub::LIFT, 0, s);
+}
+
+Closure Reducer::Shifted (Closure c, long n)
+{
+   if (n == 0) {
+      return c;
+   }
+   if (c.sub->kind == Sub::SHIFT) {
+      c.sub = NewSub (Sub::SHIFT, c.sub->n + n, NULL);
+   }
+   else if (c.sub->kind == Sub::THEN) {
+      c.sub = NewSub (Sub::THEN, c.sub->n + n, c.sub->rest);
+   }
+   else {
+      c.sub = NewSub (Sub::THEN, n, c.sub);
+   }
+   return c;
+}
+
+// What VAR i is under s.  Shifts commute, so gather them up as we go.
+Closure Reducer::Lookup (long i, const Sub * s)
+{
+   long shift = 0;
+   while (true) {
+      switch (s->kind) {
+      case Sub::SHIFT:
+         return Plain (Var (i + s->n + shift));
+
+      case Sub::CONS:
+         if (i == 0) {
+            return Shifted (s->head, shift);
+         }
+         --i;
+         break;
+
+      case Sub::LIFT:
+         if (i == 0) {
+            return Plain (Var (shift));
+         }
+         --i;
+         ++shift;
+         break;
+
+      case Sub::THEN:
+         shift += s->n;
+         break;
+      }
+      s = s->rest;
+   }
+}
+
+Closure Reducer::UnderBinder (const Head * binder)
+{
+   Closure c = { binder->body.term, Lift (binder->body.sub) };
+   return c;
+}
+
+Head * Reducer::NewHead (Head::Kind kind)
+{
+   heads.resize (heads.size() + 1);
+   Head & h = heads.back();
+   h.kind = kind;
+   return &h;
+}
+
+const Head * Reducer::Whnf (Closure c)
+{
+   while (true) {
+      Tree t = c.term;
+      int opcode = t.Left().ToInt();
+
+      if (opcode < 2) {
+         // PI or LAMBDA.
+         Head * h = NewHead (Head::Kind (opcode));
+         Closure domain = { t.Right().Left(), c.sub };
+         Closure body = { t.Right().Right(), c.sub };
+         h->domain = domain;
+         h->body = body;
+         return h;
+      }
+
+      if (opcode == 2) {
+         Closure f = { t.Right().Left(), c.sub };
+         Closure argument = { t.Right().Right(), c.sub };
+         const Head * function = Whnf (f);
+         if (function->kind == Head::LAMBDA) {
+            // Beta: the body, with the argument for VAR 0.
+            c.term = function->body.term;
+            c.sub = Cons (argument, function->body.sub);
+            continue;
+         }
+         Head * h = NewHead (Head::APPLY);
+         h->function = function;
+         h->argument = argument;
+         return h;
+      }
+
+      if (opcode == 3) {
+         Head * h = NewHead (Head::CONSTANT);
+         h->constant = t;
+         return h;
+      }
+
+      long i = (opcode - 4) / 2;
+      if (c.sub->kind == Sub::SHIFT) {
+         Head * h = NewHead (Head::VAR);
+         h->index = i + c.sub->n;
+         return h;
+      }
+      c = Lookup (i, c.sub);
+   }
+}
+
+Tree Reducer::ReadBack (const Head * h)
+{
+   switch (h->kind) {
+   case Head::PI:
+   case Head::LAMBDA:
+      return Pair (int (h->kind), Pair (Normalise (h->domain),
+                                        Normalise (UnderBinder (h))));
+   case Head::APPLY:
+      return Pair (2, Pair (ReadBack (h->function),
+                            Normalise (h->argument)));
+   case Head::VAR:
+      return Var (h->index);
+   case Head::CONSTANT:
+      return h->constant;
+   }
+
+   assert (false);
+   return 0;
+}
+
+bool Reducer::Equal (Closure a, Closure b)
+{
+   if (a.term == b.term && a.sub == b.sub) {
+      return true;
+   }
+   return Equal (Whnf (a), Whnf (b));
+}
+
+bool Reducer::Equal (const Head * a, const Head * b)
+{
+   if (a->kind != b->kind) {
+      return false;
+   }
+
+   switch (a->kind) {
+   case Head::PI:
+   case Head::LAMBDA:
+      return Equal (a->domain, b->domain)
+         &&  Equal (UnderBinder (a), UnderBinder (b));
+   case Head::APPLY:
+      return Equal (a->function, b->function)
+         &&  Equal (a->argument, b->argument);
+   case Head::VAR:
+      return a->index == b->index;
+   case Head::CONSTANT:
+      return a->constant == b->constant;
+   }
+
+   assert (false);
+   return false;
+}
+
+Tree Reducer::Materialise (Closure c)
+{
+   if (c.sub == identity) {
+      return c.term;
+   }
+#ifdef NODE_METADATA
+   // A closed term is unchanged by any substitution.
+   if (c.term.FreeTop() < 4) {
+      return c.term;
+   }
+#endif
+
+   Tree t = c.term;
+   int opcode = t.Left().ToInt();
+   if (opcode < 3) {
+      Closure l = { t.Right().Left(), c.sub };
+      Closure r = { t.Right().Right(), opcode < 2 ? Lift (c.sub) : c.sub };
+      return Pair (t.Left(), Pair (Materialise (l), Materialise (r)));
+   }
+   if (opcode == 3) {
+      return t;
+   }
+
+   long i = (opcode - 4) / 2;
+   if (c.sub->kind == Sub::SHIFT) {
+      return Var (i + c.sub->n);
+   }
+   return Materialise (Lookup (i, c.sub));
+}
+
+Tree Reducer::Materialise (const Head * h)
+{
+   switch (h->kind) {
+   case Head::PI:
+   case Head::LAMBDA:
+      return Pair (int (h->kind), Pair (Materialise (h->domain),
+                                        Materialise (UnderBinder (h))));
+   case Head::APPLY:
+      return Pair (2, Pair (Materialise (h->function),
+                            Materialise (h->argument)));
+   case Head::VAR:
+      return Var (h->index);
+   case Head::CONSTANT:
+      return h->constant;
+   }
+
+   assert (false);
+   return 0;
+}
+
+Tree EsSubst (Tree main, Tree replace)
+{
+   Reducer r;
+   Closure c = { main, r.Cons (r.Plain (replace), r.Plain (0).sub) };
+   return r.Materialise (c);
+}
+
+Tree EsWeakHeadNormalise (Tree t)
+{
+   Reducer r;
+   return r.Materialise (r.Whnf (r.Plain (t)));
+}
+
+Tree EsNormalise (Tree t)
+{
+   Reducer r;
+   return r.Normalise (r.Plain (t));
+}
+
+bool EsEquals (Tree a, Tree b)
+{
+   if (a == b) {
+      return true;
+   }
+   Reducer r;
+   return r.Equal (r.Plain (a), r.Plain (b));
+}
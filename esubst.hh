@@ -0,0 +1,22 @@
+#ifndef ESUBST_HH_
+#define ESUBST_HH_
+
+// Reduction with explicit substitutions.  A term under a substitution is kept
+// as a closure (term, substitution), and the substitution is only pushed into
+// the term as far as something looks at it.  Going under a binder wraps the
+// substitution, and shifting a closure just records the shift, so an argument
+// substituted under k binders is not lifted k times: each occurrence of it
+// that is reached is shifted once, by k.  The results are the same Trees as
+// the substituting functions in parse.cc give.
+
+#include "tree.hh"
+
+// Substitute replace for VAR 0 in main, lowering the other free variables,
+// without normalising; parse.cc's Subst (main, 0, replace).
+Tree EsSubst (Tree main, Tree replace);
+
+Tree EsWeakHeadNormalise (Tree t);
+Tree EsNormalise (Tree t);
+bool EsEquals (Tree a, Tree b);
+
+#endif
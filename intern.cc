@@ -0,0 +1,686 @@
+
+// Interning of syntax tree nodes.
+
+// Nodes are allocated from an arena of fixed size slabs, so that a node never
+// moves once it is created (with COMPACT_NODES, the arena is instead a single
+// array indexed by NodeRef).  They are found through an open addressing hash
+// table with linear probing.  When the table gets half full, a table of twice
+// the size is allocated, and the entries of the old table are migrated a few
+// at a time on each subsequent call to Intern(), so that no single call pays
+// for a complete rehash.  Collect() slides the live nodes down the arena and
+// rebuilds the table.
+
+// All the state here is plain pointers and counts, so that it is valid before
+// any static constructors run: tree.cc builds Trees during static
+// initialisation.
+
+#include "intern.hh"
+#include "stats.hh"
+#include "tree.hh"
+
+#include <algorithm>
+#include <stdlib.h>
+#include <vector>
+
+#ifdef THREADS
+#include <mutex>
+#endif
+
+static void * Allocate (size_t bytes)
+{
+   void * result = malloc (bytes);
+   if (result == NULL) {
+      std::cerr << "Out of memory allocating " << bytes << " bytes.\n";
+      abort();
+   }
+   return result;
+}
+
+#ifdef NODE_METADATA
+
+static inline int32_t ValueOf (NodeRef node)
+{
+   return node == NodeRef() ? 0 : Deref (node).value;
+}
+
+// Fill in the metadata of a new node, from that of its children.
+static void FillMetadata (Node & n)
+{
+   Tree l = Tree::FromRef (n.left);
+   Tree r = Tree::FromRef (n.right);
+
+   uint64_t h = (l.Hash() ^ 0x9E3779B97F4A7C15ull) * 0xC2B2AE3D27D4EB4Full;
+   h = (h ^ r.Hash() ^ h >> 29) * 0x165667B19E3779F9ull;
+   n.hash = h ^ h >> 32;
+
+   n.height = 1 + (l.Height() > r.Height() ? l.Height() : r.Height());
+
+   uint64_t size = 1 + (uint64_t) l.Size() + r.Size();
+   n.size = size < UINT32_MAX ? size : UINT32_MAX;
+
+   int64_t lv = ValueOf (n.left);
+   int64_t rv = ValueOf (n.right);
+   n.value = lv >= 0 && rv >= 0 && rv < 31 && (2 * lv + 1) << rv <= INT32_MAX
+      ? (2 * lv + 1) << rv : -1;
+
+   // As a term, left is the opcode, and for PI, LAMBDA and APPLY, right is
+   // the pair of subterms.  A binder lowers the opcodes free in its body by 2.
+   int32_t opcode = lv;
+   Tree a = n.right == NodeRef() ? Tree (0) : r.Left();
+   Tree b = n.right == NodeRef() ? Tree (0) : r.Right();
+   int top;
+   if (opcode < 0) {
+      top = INT32_MAX;
+   }
+   else if (opcode < 2) {
+      top = a.FreeTop() > b.FreeTop() - 2 ? a.FreeTop() : b.FreeTop() - 2;
+   }
+   else if (opcode == 2) {
+      top = a.FreeTop() > b.FreeTop() ? a.FreeTop() : b.FreeTop();
+   }
+   else {
+      top = opcode;
+   }
+   n.freeTop = top > 3 ? top : 3;
+}
+
+#else
+
+static inline void FillMetadata (Node &)
+{
+}
+
+#endif
+
+// The registered root sets.  Thread local Trees register and deregister
+// themselves as threads come and go, hence the lock.
+struct RootEntry
+{
+   RootSet roots;
+   void * data;
+};
+
+static RootEntry * Roots;
+static size_t RootCount;
+static size_t RootSpace;
+
+#ifdef THREADS
+static std::mutex RootsMutex;
+#endif
+
+void AddRoots (RootSet roots, void * data)
+{
+#ifdef THREADS
+   std::lock_guard <std::mutex> lock (RootsMutex);
+#endif
+   if (RootCount == RootSpace) {
+      RootSpace = RootSpace ? 2 * RootSpace : 16;
+      RootEntry * entries = (RootEntry *) Allocate (
+         RootSpace * sizeof (RootEntry));
+      for (size_t i = 0; i != RootCount; ++i) {
+         entries[i] = Roots[i];
+      }
+      free (Roots);
+      Roots = entries;
+   }
+   Roots[RootCount].roots = roots;
+   Roots[RootCount].data = data;
+   ++RootCount;
+}
+
+void RemoveRoots (RootSet roots, void * data)
+{
+#ifdef THREADS
+   std::lock_guard <std::mutex> lock (RootsMutex);
+#endif
+   // Roots mostly come and go in stack order, so search from the end.
+   for (size_t i = RootCount; i != 0; --i) {
+      if (Roots[i - 1].roots == roots && Roots[i - 1].data == data) {
+         Roots[i - 1] = Roots[--RootCount];
+         return;
+      }
+   }
+}
+
+// Pass NULL to call the root sets for after a collection.
+static void VisitRoots (RootVisitor visit)
+{
+   for (size_t i = 0; i != RootCount; ++i) {
+      Roots[i].roots (visit, Roots[i].data);
+   }
+}
+
+#ifdef INTERN_STDSET
+
+#if defined (COMPACT_NODES) || defined (THREADS)
+#error "INTERN_STDSET does not support COMPACT_NODES or THREADS"
+#endif
+
+#include <set>
+
+struct NodeCompare
+{
+   bool operator() (const Node & a, const Node & b) const
+      {
+         return a.left != b.left ? a.left < b.left : a.right < b.right;
+      }
+};
+
+typedef std::set <Node, NodeCompare> NodeSet;
+
+// A function static, so that it is constructed before first use.
+static NodeSet & CanonicalNodeSet()
+{
+   static NodeSet set;
+   return set;
+}
+
+NodeRef Intern (NodeRef l,
+                NodeRef r)
+{
+   TREE_STAT (++Stats.pairCalls);
+   std::pair <NodeSet::iterator, bool> inserted =
+      CanonicalNodeSet().insert (Node (l, r));
+   if (inserted.second) {
+      TREE_STAT (++Stats.pairNew);
+      // The metadata takes no part in the ordering.
+      FillMetadata (const_cast <Node &> (*inserted.first));
+   }
+   return &*inserted.first;
+}
+
+size_t NodeCount()
+{
+   return CanonicalNodeSet().size();
+}
+
+size_t InternCapacity()
+{
+   return 0;
+}
+
+// Nodes in the set never move, so just erase the unmarked ones.
+static std::set <NodeRef> * Marked;
+
+static void Mark (NodeRef & root)
+{
+   std::vector <NodeRef> stack (1, root);
+   while (!stack.empty()) {
+      NodeRef node = stack.back();
+      stack.pop_back();
+      if (node != NodeRef() && Marked->insert (node).second) {
+         stack.push_back (node->left);
+         stack.push_back (node->right);
+      }
+   }
+}
+
+size_t Collect()
+{
+   NotePeakNodes();
+   std::set <NodeRef> marked;
+   Marked = &marked;
+   VisitRoots (Mark);
+
+   NodeSet & set = CanonicalNodeSet();
+   size_t before = set.size();
+   for (NodeSet::iterator i = set.begin(); i != set.end(); ) {
+      if (marked.count (&*i) == 0) {
+         set.erase (i++);
+      }
+      else {
+         ++i;
+      }
+   }
+
+   Marked = NULL;
+   VisitRoots (NULL);
+   return before - set.size();
+}
+
+#else
+
+static size_t Nodes;
+
+#ifdef COMPACT_NODES
+
+#ifdef THREADS
+// Other threads read the arena without locking, so it must not move.
+#error "COMPACT_NODES does not support THREADS"
+#endif
+
+// The arena is a single array, reallocated as it grows; node indices stay
+// valid across that.  Index 0 is the null tree, so is never used for a node.
+Node * NodeArena;
+static size_t ArenaSize;
+
+static NodeRef NewNode (NodeRef l, NodeRef r)
+{
+   if (Nodes + 1 >= ArenaSize) {
+      if (ArenaSize > UINT32_MAX / 2) {
+         std::cerr << "Too many nodes for 32-bit node indices.\n";
+         abort();
+      }
+      size_t size = ArenaSize ? 2 * ArenaSize : 1 << 16;
+      Node * arena = (Node *) Allocate (size * sizeof (Node));
+      for (size_t i = 0; i != ArenaSize; ++i) {
+         arena[i] = NodeArena[i];
+      }
+      free (NodeArena);
+      NodeArena = arena;
+      ArenaSize = size;
+   }
+
+   NodeRef node = ++Nodes;
+   NodeArena[node] = Node (l, r);
+   FillMetadata (NodeArena[node]);
+   return node;
+}
+
+// Nodes are numbered 1, 2, ... in order of creation; here that's just the
+// index.
+static inline size_t IndexOf (NodeRef node)
+{
+   return node;
+}
+
+static inline NodeRef RefAt (size_t index)
+{
+   return index;
+}
+
+static inline Node & NodeAt (size_t index)
+{
+   return NodeArena[index];
+}
+
+static void PrepareIndex()
+{
+}
+
+// Release the arena beyond the first Nodes nodes.
+static void TrimArena()
+{
+   size_t size = 1 << 16;
+   while (size <= Nodes + 1) {
+      size *= 2;
+   }
+   if (size < ArenaSize) {
+      Node * arena = (Node *) realloc (NodeArena, size * sizeof (Node));
+      if (arena != NULL) {
+         NodeArena = arena;
+         ArenaSize = size;
+      }
+   }
+}
+
+#else
+
+// The arena.  Slabs[SlabCount - 1] is the slab currently being filled, and
+// SlabUsed the number of nodes used in it.
+static const size_t SLAB_SIZE = 1 << 16;
+
+static Node ** Slabs;
+static size_t SlabCount;
+static size_t SlabUsed;
+
+static NodeRef NewNode (NodeRef l, NodeRef r)
+{
+   if (SlabCount == 0 || SlabUsed == SLAB_SIZE) {
+      // Slabs is grown whenever SlabCount hits a power of two.
+      if ((SlabCount & (SlabCount - 1)) == 0) {
+         Node ** slabs = (Node **) Allocate (
+            (SlabCount ? 2 * SlabCount : 1) * sizeof (Node *));
+         for (size_t i = 0; i != SlabCount; ++i) {
+            slabs[i] = Slabs[i];
+         }
+         free (Slabs);
+         Slabs = slabs;
+      }
+      Slabs[SlabCount++] = (Node *) Allocate (SLAB_SIZE * sizeof (Node));
+      SlabUsed = 0;
+   }
+
+   Node * node = Slabs[SlabCount - 1] + SlabUsed++;
+   *node = Node (l, r);
+   FillMetadata (*node);
+   ++Nodes;
+   return node;
+}
+
+// Nodes are numbered 1, 2, ... in order of creation, which is their order in
+// the slabs.
+static inline Node & NodeAt (size_t index)
+{
+   return Slabs[(index - 1) / SLAB_SIZE][(index - 1) % SLAB_SIZE];
+}
+
+static inline NodeRef RefAt (size_t index)
+{
+   return &NodeAt (index);
+}
+
+// Going the other way needs the slabs sorted by address.
+struct SlabBase
+{
+   const Node * base;
+   size_t first;                // The number of the first node in the slab.
+};
+
+static SlabBase * SlabIndex;
+
+static inline size_t IndexOf (NodeRef node)
+{
+   size_t lo = 0;
+   size_t hi = SlabCount;
+   while (hi - lo > 1) {
+      size_t mid = (lo + hi) / 2;
+      if (node < SlabIndex[mid].base) {
+         hi = mid;
+      }
+      else {
+         lo = mid;
+      }
+   }
+   return SlabIndex[lo].first + (node - SlabIndex[lo].base);
+}
+
+static bool SlabBaseLess (const SlabBase & a, const SlabBase & b)
+{
+   return a.base < b.base;
+}
+
+static void PrepareIndex()
+{
+   free (SlabIndex);
+   SlabIndex = (SlabBase *) Allocate ((SlabCount + 1) * sizeof (SlabBase));
+   for (size_t i = 0; i != SlabCount; ++i) {
+      SlabIndex[i].base = Slabs[i];
+      SlabIndex[i].first = i * SLAB_SIZE + 1;
+   }
+   std::sort (SlabIndex, SlabIndex + SlabCount, SlabBaseLess);
+}
+
+// Release the slabs beyond the first Nodes nodes.
+static void TrimArena()
+{
+   size_t used = (Nodes + SLAB_SIZE - 1) / SLAB_SIZE;
+   while (SlabCount > used) {
+      free (Slabs[--SlabCount]);
+   }
+   SlabUsed = Nodes - (SlabCount ? (SlabCount - 1) * SLAB_SIZE : 0);
+   free (SlabIndex);
+   SlabIndex = NULL;
+}
+
+#endif
+
+// A hash table; the number of slots is mask + 1, a power of two.  Empty slots
+// hold the null NodeRef.
+struct Table
+{
+   size_t mask;
+   NodeRef slots[1];            // Really mask + 1 of them.
+};
+
+// Current is where new entries go.  While Old is non-NULL we are part way
+// through growing, and the slots of Old before OldCursor have been copied into
+// Current.
+static Table * Current;
+static Table * Old;
+static size_t OldCursor;
+
+// With -DTHREADS, Intern() may be called from several threads.  Lookups of
+// existing nodes take no lock: slots are only ever filled in, never cleared,
+// so a node found in any table, even one that has since been replaced, is the
+// right one; on a miss we take InternMutex and look again.  For that to be
+// safe, tables that are replaced are never freed.  (They add up to less than
+// the size of Current.)  The atomic loads and stores below are plain moves on
+// x86, so the single threaded build pays nothing for them.
+#ifdef THREADS
+static std::mutex InternMutex;
+#endif
+
+template <typename T> static inline T Load (T * p)
+{
+   return __atomic_load_n (p, __ATOMIC_ACQUIRE);
+}
+
+template <typename T> static inline void Store (T * p, T value)
+{
+   __atomic_store_n (p, value, __ATOMIC_RELEASE);
+}
+
+static const size_t INITIAL_SLOTS = 1 << 10;
+
+// Old slots to migrate per call to Intern().  Growing happens at half full, and
+// then the table doubles, so we need at least 2 to have finished migrating
+// before the next grow; be generous.
+static const size_t MIGRATE_STEP = 8;
+
+static inline size_t Hash (NodeRef l, NodeRef r)
+{
+   uint64_t h = (uint64_t) (uintptr_t) l * 0x9E3779B97F4A7C15ull
+      ^       (uint64_t) (uintptr_t) r * 0xC2B2AE3D27D4EB4Full;
+   return h ^ h >> 29;
+}
+
+// Find the slot holding (l,r), or else the empty slot where it would go.
+static inline NodeRef * Probe (Table * table, size_t hash,
+                               NodeRef l, NodeRef r)
+{
+   for (size_t i = hash & table->mask; ; i = (i + 1) & table->mask) {
+      NodeRef node = Load (table->slots + i);
+      if (node == NodeRef() ||
+          (Deref (node).left == l && Deref (node).right == r)) {
+         return table->slots + i;
+      }
+   }
+}
+
+static void Retire (Table * table)
+{
+#ifndef THREADS
+   free (table);
+#endif
+}
+
+static void Migrate (size_t count)
+{
+   for (; count != 0 && OldCursor <= Old->mask; --count, ++OldCursor) {
+      NodeRef node = Old->slots[OldCursor];
+      if (node != NodeRef()) {
+         const Node & n = Deref (node);
+         Store (Probe (Current, Hash (n.left, n.right), n.left, n.right),
+                node);
+      }
+   }
+
+   if (OldCursor > Old->mask) {
+      Table * old = Old;
+      Store (&Old, (Table *) NULL);
+      Retire (old);
+   }
+}
+
+static Table * NewTable (size_t size)
+{
+   Table * table = (Table *) Allocate (
+      sizeof (Table) + (size - 1) * sizeof (NodeRef));
+   table->mask = size - 1;
+   for (size_t i = 0; i != size; ++i) {
+      table->slots[i] = NodeRef();
+   }
+   return table;
+}
+
+static void Grow()
+{
+   if (Old != NULL) {
+      // Shouldn't happen given MIGRATE_STEP, but finish off anyway.
+      Migrate (Old->mask + 1);
+   }
+
+   OldCursor = 0;
+   Store (&Old, Current);
+   Store (&Current, NewTable (2 * (Old->mask + 1)));
+}
+
+NodeRef Intern (NodeRef l,
+                NodeRef r)
+{
+   TREE_STAT (++Stats.pairCalls);
+   size_t hash = Hash (l, r);
+
+#ifdef THREADS
+   Table * current = Load (&Current);
+   if (current != NULL) {
+      NodeRef node = Load (Probe (current, hash, l, r));
+      if (node != NodeRef()) {
+         return node;
+      }
+   }
+   Table * old = Load (&Old);
+   if (old != NULL) {
+      NodeRef node = Load (Probe (old, hash, l, r));
+      if (node != NodeRef()) {
+         return node;
+      }
+   }
+
+   std::lock_guard <std::mutex> lock (InternMutex);
+#endif
+
+   if (Current == NULL) {
+      Store (&Current, NewTable (INITIAL_SLOTS));
+   }
+
+   if (Old != NULL) {
+      Migrate (MIGRATE_STEP);
+   }
+
+   NodeRef * slot = Probe (Current, hash, l, r);
+   if (*slot != NodeRef()) {
+      return *slot;
+   }
+
+   if (Old != NULL) {
+      // Not migrated yet; Migrate() will copy it to Current in due course.
+      NodeRef node = *Probe (Old, hash, l, r);
+      if (node != NodeRef()) {
+         return node;
+      }
+   }
+
+   // NewNode() may move the arena, but not the table.
+   TREE_STAT (++Stats.pairNew);
+   NodeRef node = NewNode (l, r);
+   Store (slot, node);
+
+   if (2 * Nodes > Current->mask + 1) {
+      Grow();
+   }
+
+   return node;
+}
+
+size_t NodeCount()
+{
+   return Nodes;
+}
+
+size_t InternCapacity()
+{
+   return (Current ? Current->mask + 1 : 0) + (Old ? Old->mask + 1 : 0);
+}
+
+// Collect() is a sliding compactor.  A node is always created after its
+// children, so moving the live nodes down to the start of the arena, in
+// order, moves each node's children before the node itself.  Forward[i] is
+// non-zero if node i is marked, and once node i is moved, its new number.
+// That costs a word per node while collecting.
+static size_t * Forward;
+
+static void Mark (NodeRef & root)
+{
+   static std::vector <NodeRef> stack;
+   if (root == NodeRef() || Forward[IndexOf (root)] != 0) {
+      return;
+   }
+
+   Forward[IndexOf (root)] = 1;
+   stack.push_back (root);
+   while (!stack.empty()) {
+      const Node & n = Deref (stack.back());
+      stack.pop_back();
+      NodeRef children[2] = { n.left, n.right };
+      for (int i = 0; i != 2; ++i) {
+         if (children[i] != NodeRef() && Forward[IndexOf (children[i])] == 0) {
+            Forward[IndexOf (children[i])] = 1;
+            stack.push_back (children[i]);
+         }
+      }
+   }
+}
+
+static inline NodeRef Moved (NodeRef node)
+{
+   return node == NodeRef() ? node : RefAt (Forward[IndexOf (node)]);
+}
+
+static void Relocate (NodeRef & root)
+{
+   root = Moved (root);
+}
+
+size_t Collect()
+{
+   NotePeakNodes();
+   size_t before = Nodes;
+   PrepareIndex();
+   Forward = (size_t *) Allocate ((Nodes + 1) * sizeof (size_t));
+   for (size_t i = 0; i <= Nodes; ++i) {
+      Forward[i] = 0;
+   }
+
+   VisitRoots (Mark);
+
+   size_t live = 0;
+   for (size_t i = 1; i <= Nodes; ++i) {
+      if (Forward[i] != 0) {
+         // The metadata doesn't depend on where the children are.
+         Node moved = NodeAt (i);
+         moved.left = Moved (moved.left);
+         moved.right = Moved (moved.right);
+         Forward[i] = ++live;
+         NodeAt (live) = moved;
+      }
+   }
+
+   VisitRoots (Relocate);
+
+   free (Forward);
+   Forward = NULL;
+   Nodes = live;
+   TrimArena();
+
+   // Rebuild the hash table from scratch, at the size it would have grown to.
+   free (Current);
+   free (Old);
+   Old = NULL;
+   size_t size = INITIAL_SLOTS;
+   while (size < 2 * Nodes) {
+      size *= 2;
+   }
+   Current = NewTable (size);
+   for (size_t i = 1; i <= Nodes; ++i) {
+      const Node & n = NodeAt (i);
+      *Probe (Current, Hash (n.left, n.right), n.left, n.right) = RefAt (i);
+   }
+
+   VisitRoots (NULL);
+
+   return before - live;
+}
+
+#endif
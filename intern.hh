@@ -0,0 +1,75 @@
+#ifndef INTERN_HH_
+#define INTERN_HH_
+
+// Hash-consing of syntax tree nodes.  Intern() (declared in tree.hh) returns
+// the unique Node with the given children, so that structurally equal trees
+// are always the same Node.  This header exposes the bookkeeping behind it.
+
+// By default nodes live in an arena of fixed size slabs and are found through
+// an open addressing hash table that grows incrementally.  Compile with
+// -DINTERN_STDSET to get the original std::set based table instead, e.g., to
+// compare the two on the same workload.  -DCOMPACT_NODES (see tree.hh) keeps
+// the nodes in one array and refers to them by 32-bit index.  -DTHREADS makes
+// Intern() safe to call from several threads.  -DNODE_METADATA has Intern()
+// store a hash, height, size and so on in each node (see tree.hh), which makes
+// nodes two and a half times the size.
+
+#include "tree.hh"
+
+#include <stddef.h>
+
+// The number of distinct nodes created so far.
+size_t NodeCount();
+
+// The number of slots in the hash table (including any table still being
+// migrated from).  Zero for the std::set implementation.
+size_t InternCapacity();
+
+// Garbage collection.  Collect() frees every node not reachable from the
+// registered roots, and compacts the survivors, so that nodes move: the roots
+// are updated, but any other Tree or NodeRef is left dangling.  So only call
+// it when every live Tree is a root, and no other thread is interning.
+// Returns the number of nodes freed.  (With INTERN_STDSET nodes don't move.)
+size_t Collect();
+
+// A root set is a function that calls 'visit' on each NodeRef it holds; it
+// must visit the same ones both times it is called during a collection.  It is
+// then called a third time with 'visit' NULL, e.g., to rehash a table keyed on
+// NodeRefs, which have changed.
+typedef void (*RootVisitor) (NodeRef & ref);
+typedef void (*RootSet) (RootVisitor visit, void * data);
+
+void AddRoots (RootSet roots, void * data);
+void RemoveRoots (RootSet roots, void * data);
+
+// A Tree that is its own root, for holding on to a Tree across Collect().
+struct RootedTree : Tree
+{
+   RootedTree() :
+      Tree (0)
+      { AddRoots (Visit, this); }
+   RootedTree (const Tree & t) :
+      Tree (t)
+      { AddRoots (Visit, this); }
+   RootedTree (const RootedTree & t) :
+      Tree (t)
+      { AddRoots (Visit, this); }
+   ~RootedTree()
+      { RemoveRoots (Visit, this); }
+
+   RootedTree & operator= (const Tree & t)
+      {
+         it = t.it;
+         return *this;
+      }
+
+private:
+   static void Visit (RootVisitor visit, void * data)
+      {
+         if (visit != NULL) {
+            visit (static_cast <RootedTree *> (data)->it);
+         }
+      }
+};
+
+#endif
@@ -0,0 +1,269 @@
+// The Krivine machine.
+
+#include "machine.hh"
+#include "stats.hh"
+
+#include <vector>
+
+struct Binding;
+
+// A closure: term in the environment env.  A variable that readback has gone
+// under a binder for, or that is free, is a closure with term 0 and its level:
+// levels count binders from the outside, so need no adjusting as we go under
+// binders.  The free VAR n has level -1 - n.
+struct Thunk
+{
+   Tree term;
+   const Binding * env;
+   long level;
+
+   // The normal form, read back under 'depth' binders; depth is -1 if not
+   // yet.
+   long depth;
+   Tree normal;
+};
+
+// The environment: what VAR 0, VAR 1, ... are, innermost first.
+struct Binding
+{
+   Thunk * value;
+   const Binding * next;
+};
+
+// Allocation for one run, kept for the next.
+template <typename T>
+class Pool
+{
+public:
+   Pool() : used (0) { }
+   ~Pool()
+      {
+         for (size_t i = 0; i != blocks.size(); ++i) {
+            delete[] blocks[i];
+         }
+      }
+
+   T * New()
+      {
+         if (used == blocks.size() * BLOCK) {
+            blocks.push_back (new T[BLOCK]);
+         }
+         T * t = &blocks[used / BLOCK][used % BLOCK];
+         ++used;
+         return t;
+      }
+
+   void Clear() { used = 0; }
+
+private:
+   static const size_t BLOCK = 1024;
+   std::vector <T *> blocks;
+   size_t used;
+};
+
+class Machine
+{
+public:
+   Tree Subst (int vv, Tree yy, int context, Tree term);
+
+private:
+   Thunk * New (Tree term, const Binding * env);
+   Thunk * Variable (long level);
+   const Binding * Bind (Thunk * value, const Binding * env);
+
+   // What VAR n is in env: a closure, or NULL with its level set if it is a
+   // variable.
+   Thunk * Lookup (const Binding * env, long n, long & level);
+
+   // Reduce term in env, and read back its normal form under 'depth'
+   // binders.
+   Tree Normal (Tree term, const Binding * env, long depth);
+
+   // The same for a shared closure, which remembers the result.
+   Tree Normal (Thunk * t, long depth);
+
+   // The term substituted into is in the environment &root, past the end of
+   // which are the variables of pure.c's Subst: VAR var is yy, and the ones
+   // above it are shifted down by 'shift'.  yy is in the empty environment,
+   // past the end of which VAR n is just free.
+   Binding root;
+   long var;
+   long shift;
+
+   // The arguments, innermost application first; and the closures to update
+   // when they are reduced, with the stack height they were entered at.
+   std::vector <Thunk *> stack;
+   std::vector <std::pair <Thunk *, size_t> > updates;
+
+   Pool <Thunk> thunks;
+   Pool <Binding> bindings;
+};
+
+Thunk * Machine::New (Tree term, const Binding * env)
+{
+   Thunk * t = thunks.New();
+   t->term = term;
+   t->env = env;
+   t->depth = -1;
+   return t;
+}
+
+Thunk * Machine::Variable (long level)
+{
+   Thunk * t = New (0, NULL);
+   t->level = level;
+   return t;
+}
+
+const Binding * Machine::Bind (Thunk * value, const Binding * env)
+{
+   Binding * b = bindings.New();
+   b->value = value;
+   b->next = env;
+   return b;
+}
+
+Thunk * Machine::Lookup (const Binding * env, long n, long & level)
+{
+   Thunk * value = NULL;
+   for (; env != NULL && env != &root; env = env->next, --n) {
+      if (n == 0) {
+         value = env->value;
+         break;
+      }
+   }
+   if (value == NULL && env == &root && n >= var) {
+      if (n == var) {
+         value = root.value;
+      }
+      n -= shift;
+   }
+   if (value == NULL) {
+      level = -1 - n;
+   }
+   else if (value->term.IsNull()) {
+      // Updated to a variable.
+      level = value->level;
+      value = NULL;
+   }
+   return value;
+}
+
+Tree Machine::Normal (Thunk * t, long depth)
+{
+   if (t->depth != depth) {
+      t->normal = t->term.IsNull()
+         ? Tree (Pair (int (4 + 2 * (depth - 1 - t->level)), 0))
+         : Normal (t->term, t->env, depth);
+      t->depth = depth;
+   }
+   return t->normal;
+}
+
+Tree Machine::Normal (Tree term, const Binding * env, long depth)
+{
+   // Our recursion stands for pure.c's, so counts as Subst depth.
+   TREE_STAT (Stats.substMaxDepth < ++Stats.substDepth
+              && (Stats.substMaxDepth = Stats.substDepth));
+   const size_t base = stack.size();
+   const size_t updateBase = updates.size();
+   Tree result;
+   for (;;) {
+      int opcode = term.Left().ToInt();
+      if (opcode == 2) {
+         // APPLY: push the argument.
+         stack.push_back (New (term.Right().Right(), env));
+         term = term.Right().Left();
+         continue;
+      }
+
+      if (opcode > 3) {
+         // A variable: enter its closure, unless it is a variable there too.
+         long level;
+         Thunk * v = Lookup (env, (opcode - 4) / 2, level);
+         if (v != NULL && v->depth == depth && stack.size() == base) {
+            result = v->normal;
+            break;
+         }
+         if (v != NULL) {
+            updates.push_back (std::make_pair (v, stack.size()));
+            term = v->term;
+            env = v->env;
+            continue;
+         }
+         // The closures entered with no arguments of their own were this.
+         for (; updates.size() != updateBase
+                 && updates.back().second == stack.size();
+              updates.pop_back()) {
+            Thunk * u = updates.back().first;
+            u->term = 0;
+            u->level = level;
+         }
+         result = Pair (int (4 + 2 * (depth - 1 - level)), 0);
+         break;
+      }
+
+      // A weak head normal form, for the closures entered with no arguments
+      // of their own.
+      for (; updates.size() != updateBase
+              && updates.back().second == stack.size();
+           updates.pop_back()) {
+         updates.back().first->term = term;
+         updates.back().first->env = env;
+      }
+
+      if (opcode == 1 && stack.size() != base) {
+         // A LAMBDA with an argument: bind it.
+         TREE_STAT (++Stats.machineBeta);
+         env = Bind (stack.back(), env);
+         stack.pop_back();
+         term = term.Right().Right();
+         continue;
+      }
+
+      if (opcode == 3) {
+         result = term;         // STAR or BOX.
+      }
+      else {
+         // PI or LAMBDA.
+         Tree domain = Normal (term.Right().Left(), env, depth);
+         Tree body = Normal (term.Right().Right(),
+                             Bind (Variable (depth), env), depth + 1);
+         result = Pair (opcode, Pair (domain, body));
+      }
+      break;
+   }
+
+   // Closures entered with arguments of their own reduce to something stuck:
+   // leave them be.
+   updates.resize (updateBase);
+
+   // The arguments the head is stuck with.
+   while (stack.size() != base) {
+      Thunk * argument = stack.back();
+      stack.pop_back();
+      result = Pair (2, Pair (result, Normal (argument, depth)));
+   }
+   TREE_STAT (--Stats.substDepth);
+   return result;
+}
+
+Tree Machine::Subst (int vv, Tree yy, int context, Tree term)
+{
+   TREE_STAT (++Stats.machineRuns);
+   var = (vv - 4) / 2;
+   shift = context / 4;
+   root.value = New (yy, NULL);
+   root.next = NULL;
+   Tree result = Normal (term, &root, 0);
+   thunks.Clear();
+   bindings.Clear();
+   return result;
+}
+
+static THREAD_LOCAL Machine TheMachine;
+
+Tree MachineSubst (int vv, Tree yy, int context, Tree term)
+{
+   return TheMachine.Subst (vv, yy, context, term);
+}
@@ -0,0 +1,23 @@
+#ifndef MACHINE_HH_
+#define MACHINE_HH_
+
+// A Krivine machine for pure.c's Subst, and so for Apply, whose beta
+// reduction is a Subst.  pure.c reduces by mutual recursion: Subst rebuilds
+// the term, calling Apply on each application, which calls Subst on the body
+// of each redex, and every term in between is interned.  The machine instead
+// reduces a closure (a term and an environment) to weak head normal form, with
+// a stack of arguments, and only builds Trees as it reads back the normal form.
+// Arguments are closures shared by each use of the variable they are bound to;
+// each is updated with its weak head normal form when first reduced, and
+// remembers its normal form once read back.
+
+#include "tree.hh"
+
+// pure.c's Subst (vv, yy, context, term): substitute yy for the variable with
+// opcode vv, take context / 4 off the indices of the variables above it, and
+// normalise.  pure.c substitutes hereditarily, and so gives the normal form
+// when yy and term are normal, as they always are from Derive.  The normal
+// form is unique, so the result is the same Tree.
+Tree MachineSubst (int vv, Tree yy, int context, Tree term);
+
+#endif
@@ -0,0 +1,186 @@
+
+// A bounded, set associative cache of function results.
+
+#include "memo.hh"
+
+#include <vector>
+
+MemoTable::MemoTable (const char * n) :
+   name (n),
+   hits (0),
+   misses (0),
+   evictions (0),
+   entries (NULL),
+   setMask (0),
+   ways (0),
+   policy (LRU),
+   clock (0)
+{
+   AddRoots (VisitRoots, this);
+}
+
+MemoTable::~MemoTable()
+{
+   RemoveRoots (VisitRoots, this);
+   delete[] entries;
+}
+
+void MemoTable::VisitRoots (RootVisitor visit, void * data)
+{
+   MemoTable * table = static_cast <MemoTable *> (data);
+   if (table->entries == NULL) {
+      return;
+   }
+   if (visit == NULL) {
+      table->Rehash();
+      return;
+   }
+   for (size_t i = 0; i != (table->setMask + 1) * table->ways; ++i) {
+      Entry & entry = table->entries[i];
+      if (entry.stamp != 0) {
+         visit (entry.key.a);
+         visit (entry.key.b);
+         visit (entry.value);
+      }
+   }
+}
+
+void MemoTable::Configure (size_t size, unsigned w, Policy p)
+{
+   delete[] entries;
+   entries = NULL;
+
+   if (size == 0) {
+      return;
+   }
+
+   assert (w != 0);
+   size_t sets = 1;
+   while (sets * w < size) {
+      sets *= 2;
+   }
+
+   entries = new Entry[sets * w];
+   setMask = sets - 1;
+   ways = w;
+   policy = p;
+   Clear();
+}
+
+void MemoTable::ConfigureLike (const MemoTable & other)
+{
+   if (other.Enabled()) {
+      Configure ((other.setMask + 1) * other.ways, other.ways, other.policy);
+   }
+   else {
+      Configure (0);
+   }
+}
+
+void MemoTable::Rehash()
+{
+   size_t count = (setMask + 1) * ways;
+   std::vector <Entry> old (entries, entries + count);
+   Clear();
+
+   // Where keys now collide, keep the most recent.
+   for (size_t i = 0; i != count; ++i) {
+      if (old[i].stamp == 0) {
+         continue;
+      }
+      Entry * set = Set (old[i].key);
+      Entry * victim = set;
+      for (unsigned j = 0; j != ways; ++j) {
+         if (set[j].stamp < victim->stamp) {
+            victim = set + j;
+         }
+      }
+      if (victim->stamp < old[i].stamp) {
+         *victim = old[i];
+      }
+   }
+}
+
+void MemoTable::Clear()
+{
+   if (entries == NULL) {
+      return;
+   }
+   for (size_t i = 0; i != (setMask + 1) * ways; ++i) {
+      entries[i].stamp = 0;
+   }
+}
+
+MemoTable::Entry * MemoTable::Set (const MemoKey & key) const
+{
+   unsigned long long h =
+      (unsigned long long) (uintptr_t) key.a * 0x9E3779B97F4A7C15ull
+      ^ (unsigned long long) (uintptr_t) key.b * 0xC2B2AE3D27D4EB4Full
+      ^ (unsigned long long) (unsigned) key.m * 0x165667B19E3779F9ull
+      ^ (unsigned long long) (unsigned) key.n * 0x27D4EB2F165667C5ull;
+   h ^= h >> 31;
+   return entries + (h & setMask) * ways;
+}
+
+bool MemoTable::Lookup (const MemoKey & key, Tree & value)
+{
+   if (entries == NULL) {
+      return false;
+   }
+
+   Entry * set = Set (key);
+   for (unsigned i = 0; i != ways; ++i) {
+      if (set[i].stamp != 0 && set[i].key == key) {
+         if (policy == LRU) {
+            set[i].stamp = ++clock;
+         }
+         value = Tree::FromRef (set[i].value);
+         ++hits;
+         return true;
+      }
+   }
+
+   ++misses;
+   return false;
+}
+
+void MemoTable::Insert (const MemoKey & key, Tree value)
+{
+   if (entries == NULL) {
+      return;
+   }
+
+   // Use an empty entry if there is one, else the oldest.
+   Entry * set = Set (key);
+   Entry * victim = set;
+   for (unsigned i = 0; i != ways; ++i) {
+      if (set[i].stamp < victim->stamp) {
+         victim = set + i;
+      }
+   }
+
+   if (victim->stamp != 0) {
+      ++evictions;
+   }
+
+   victim->key = key;
+   victim->value = value.it;
+   victim->stamp = ++clock;
+}
+
+void MemoTable::Absorb (const MemoTable & other)
+{
+   hits += other.hits;
+   misses += other.misses;
+   evictions += other.evictions;
+}
+
+std::ostream & MemoTable::Report (std::ostream & s) const
+{
+   unsigned long long lookups = hits + misses;
+   s << name << " memo: " << hits << " hits, " << misses << " misses";
+   if (lookups != 0) {
+      s << " (" << 100 * hits / lookups << "% hit rate)";
+   }
+   return s << ", " << evictions << " evictions.\n";
+}
@@ -0,0 +1,112 @@
+#ifndef MEMO_HH_
+#define MEMO_HH_
+
+// A bounded cache of function results, keyed on interned Trees plus a couple
+// of small integers.  Because Trees are hash-consed, the functions in pure.c
+// are pure functions of the node identities of their arguments, so their
+// results can be looked up rather than recomputed.
+
+// The table is set associative: each key hashes to a set of 'ways' entries,
+// and when the set is full one of them is evicted according to the policy.
+// One way gives a direct mapped cache.  An unconfigured table is disabled:
+// Lookup() always misses and Insert() does nothing.
+
+// The entries are roots for Collect() (see intern.hh), so survive it.
+
+#include "intern.hh"
+#include "tree.hh"
+
+struct MemoKey
+{
+   MemoKey() { }
+   MemoKey (Tree x, Tree y, int i = 0, int j = 0) :
+      a (x.it),
+      b (y.it),
+      m (i),
+      n (j)
+      { }
+
+   bool operator== (const MemoKey & other) const
+      {
+         return a == other.a && b == other.b && m == other.m && n == other.n;
+      }
+
+   NodeRef a;
+   NodeRef b;
+   int m;
+   int n;
+};
+
+class MemoTable
+{
+public:
+   enum Policy {
+      LRU,                      // Evict the least recently used.
+      FIFO                      // Evict the least recently inserted.
+   };
+
+   MemoTable (const char * name);
+   ~MemoTable();
+
+   // Size the table to (about) 'size' entries, discarding the contents.  A
+   // size of zero disables the table.
+   void Configure (size_t size, unsigned ways = 4, Policy policy = LRU);
+
+   // Configure the same as another table.
+   void ConfigureLike (const MemoTable & other);
+
+   bool Enabled() const { return entries != NULL; }
+
+   bool Lookup (const MemoKey & key, Tree & value);
+   void Insert (const MemoKey & key, Tree value);
+
+   // Discard the contents (but not the counters).
+   void Clear();
+
+   // Add in the counters of another table, e.g., another thread's.
+   void Absorb (const MemoTable & other);
+
+   std::ostream & Report (std::ostream & s) const;
+
+   const char * const name;
+
+   unsigned long long hits;
+   unsigned long long misses;
+   unsigned long long evictions;
+
+private:
+   struct Entry
+   {
+      MemoKey key;
+      NodeRef value;
+      unsigned long long stamp; // Zero if the entry is empty.
+   };
+
+   Entry * Set (const MemoKey & key) const;
+
+   static void VisitRoots (RootVisitor visit, void * data);
+
+   // Move the entries to the right sets after Collect() changes their keys.
+   void Rehash();
+
+   Entry * entries;
+   size_t setMask;
+   unsigned ways;
+   Policy policy;
+   unsigned long long clock;
+};
+
+// The tables used by the wrappers around pure.c in tree.cc.  With -DTHREADS
+// each thread has its own.
+extern THREAD_LOCAL MemoTable SubstMemo;
+extern THREAD_LOCAL MemoTable ApplyMemo;
+
+// DeriveMemo maps a bitstream to the items Derive pushed onto accumulate for
+// it, which are pushed again on a hit.  DeriveReplayed counts those.
+extern THREAD_LOCAL MemoTable DeriveMemo;
+extern THREAD_LOCAL unsigned long long DeriveReplayed;
+
+// Report DeriveMemo, and how many judgments were derived versus replayed.
+std::ostream & ReportDeriveMemo (std::ostream & s);
+
+#endif
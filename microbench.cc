@@ -0,0 +1,425 @@
+// Microbenchmarks of the Tree runtime, the pure.c kernels and the parse
+// engines.  Each benchmark is run with a doubling number of operations until
+// it takes long enough to time, and reported per operation: time, operator new
+// calls, and nodes interned.
+
+// Usage: microbench [--json] [--min-time MS] [FILTER]
+//  --json         Print the results as JSON, e.g., to keep for comparison with
+//                 later commits.
+//  --min-time MS  Time each benchmark over at least MS milliseconds (100).
+//  FILTER         Only run the benchmarks with FILTER in their name.
+
+#include "batchparse.hh"
+#include "bitstream.hh"
+#include "intern.hh"
+#include "parse.hh"
+#include "tree.hh"
+#include "typecheck.hh"
+
+#include <chrono>
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+static unsigned long long Allocations;
+
+void * operator new (size_t size)
+{
+   ++Allocations;
+   void * p = malloc (size == 0 ? 1 : size);
+   if (p == NULL) {
+      throw std::bad_alloc();
+   }
+   return p;
+}
+
+void operator delete (void * p) noexcept
+{
+   free (p);
+}
+
+void operator delete (void * p, size_t) noexcept
+{
+   free (p);
+}
+
+// Results go here, so that the work can't be optimised away.
+static Tree Sink;
+static volatile long IntSink;
+
+// The benchmarks that cycle through inputs use this many.
+static const unsigned long Cycle = 1024;
+
+// The inputs, set up by Setup().
+static Tree Chain;
+static std::vector <Tree> Numbers;
+static Tree Twice;                     // The term [P:*][f:P>P][x:P]f (f x).
+static Tree TwiceBits;                 // Its bitstream, for Derive.
+static Tree Three;                     // Church numeral 3, normalised.
+static Tree Power;                     // (3 3), unnormalised.
+static Tree PowerNormal;
+static const char * const Text =
+   "[A:*][B:{x:A}*][f:{x:A}B x][a:A][g:A>A>A]f (g a (g a a))";
+static BatchParser Batch;
+static Tree TextTerm;
+static TypeChecker Checker (256);      // Small, as TypeCheck clears it.
+static Tree Deep;                      // A variable weakened past 12 others.
+
+static Tree Parse (const char * text)
+{
+   Tree term;
+   const char * rest = ParseTerm (term, VarList(), text);
+   assert (*SkipWhite (rest) == 0);
+   return term;
+}
+
+static void Setup()
+{
+   for (unsigned long i = 1; i <= Cycle; ++i) {
+      Numbers.push_back (int (i) * 7919);
+   }
+
+   Twice = Parse ("[P:*][f:P>P][x:P]f (f x)");
+   Deep = Parse ("[T:*][a:T][b:T][c:T][d:T][e:T][f:T][g:T][h:T][i:T][j:T]"
+                 "[k:T][l:T][m:T]a");
+   Bits bits;
+   bits.push_back (false);
+   Tree type;
+   Generate (bits, Context(), Twice, type);
+   TwiceBits = BitsToTree (bits);
+
+   const char * three = "[f:*>*][x:*]f (f (f x))";
+   Three = Normalise (Parse (three));
+   Power = Parse ("([f:*>*][x:*]f (f (f x))) ([f:*>*][x:*]f (f (f x)))");
+   PowerNormal = Normalise (Power);
+
+   Tree batch;
+   assert (Batch.Parse (Text, batch) == BatchParser::OK);
+   assert (batch == Parse (Text));
+   TextTerm = batch;
+}
+
+// Interning.
+static void PairHit (unsigned long n)
+{
+   Tree a = Numbers[0], b = Numbers[1];
+   for (unsigned long i = 0; i != n; ++i) {
+      Sink = Pair (a, b);
+   }
+}
+
+static void PairMiss (unsigned long n)
+{
+   // Each Pair is a new node, as Chain only grows.
+   for (unsigned long i = 0; i != n; ++i) {
+      Chain = Pair (Chain, 0);
+   }
+}
+
+// Arithmetic, on numbers whose results are interned after the first pass.
+static void Increment (unsigned long n)
+{
+   for (unsigned long i = 0; i != n; ++i) {
+      Sink = Numbers[i % Numbers.size()].Increment();
+   }
+}
+
+static void Decrement (unsigned long n)
+{
+   for (unsigned long i = 0; i != n; ++i) {
+      Sink = Numbers[i % Numbers.size()].Decrement();
+   }
+}
+
+static void Halve (unsigned long n)
+{
+   for (unsigned long i = 0; i != n; ++i) {
+      Sink = Numbers[i % Numbers.size()].Halve();
+   }
+}
+
+static void ToInt (unsigned long n)
+{
+   for (unsigned long i = 0; i != n; ++i) {
+      IntSink = Numbers[i % Numbers.size()].ToInt();
+   }
+}
+
+// pure.c, through the wrappers in tree.cc.  The memo tables are not
+// configured, so each call does the work.
+static void SubstLift (unsigned long n)
+{
+   for (unsigned long i = 0; i != n; ++i) {
+      Sink = Subst (4, 13, -4, PowerNormal);
+   }
+}
+
+static void ApplyPower (unsigned long n)
+{
+   for (unsigned long i = 0; i != n; ++i) {
+      Sink = Apply (Three, Three);
+   }
+}
+
+static void DeriveTwice (unsigned long n)
+{
+   for (unsigned long i = 0; i != n; ++i) {
+      Sink = Derive (TwiceBits).Left();
+   }
+}
+
+static void DeriveSmall (unsigned long n)
+{
+   for (unsigned long i = 0; i != n; ++i) {
+      Sink = Derive (i % Cycle).Left();
+   }
+}
+
+// parse's engines.
+static void NormaliseWith (NormaliseEngine engine, unsigned long n)
+{
+   Engine = engine;
+   for (unsigned long i = 0; i != n; ++i) {
+      Sink = Normalise (Power);
+   }
+   Engine = SUBSTITUTION;
+}
+
+static void NormaliseSubstitution (unsigned long n)
+{
+   NormaliseWith (SUBSTITUTION, n);
+}
+
+static void NormaliseEvaluation (unsigned long n)
+{
+   NormaliseWith (EVALUATION, n);
+}
+
+static void NormaliseExplicit (unsigned long n)
+{
+   NormaliseWith (EXPLICIT, n);
+}
+
+static void Equals (unsigned long n)
+{
+   for (unsigned long i = 0; i != n; ++i) {
+      IntSink = NormalisedEquals (Power, PowerNormal);
+   }
+}
+
+static void ParseText (unsigned long n)
+{
+   for (unsigned long i = 0; i != n; ++i) {
+      Sink = Parse (Text);
+   }
+}
+
+static void BatchParseText (unsigned long n)
+{
+   for (unsigned long i = 0; i != n; ++i) {
+      Batch.Parse (Text, Sink);
+   }
+}
+
+static void GenerateTerm (Tree term, size_t memoBits, unsigned long n)
+{
+   size_t saved = GenerateMemoBits;
+   GenerateMemoBits = memoBits;
+   for (unsigned long i = 0; i != n; ++i) {
+      Bits bits;
+      Tree type;
+      Generate (bits, Context(), term, type);
+      IntSink = bits.size();
+   }
+   GenerateMemoBits = saved;
+}
+
+static void GenerateTwice (unsigned long n)
+{
+   GenerateTerm (Twice, 0, n);
+}
+
+static void GenerateDeep (unsigned long n)
+{
+   GenerateTerm (Deep, 0, n);
+}
+
+// After the first, these hit in the memo, so this is the cost of splicing.
+static void GenerateDeepMemo (unsigned long n)
+{
+   GenerateTerm (Deep, ~size_t (0), n);
+}
+
+// A fresh optimiser each time, so this is the whole search.
+static void GenerateShortestDeep (unsigned long n)
+{
+   for (unsigned long i = 0; i != n; ++i) {
+      Bits bits;
+      Tree type;
+      GenerateShortest (bits, Context(), Deep, type);
+      IntSink = bits.size();
+   }
+}
+
+// Type checking directly, against encoding and deriving.  The cache is
+// cleared each time, so this is the whole check.
+static void TypeCheck (unsigned long n)
+{
+   for (unsigned long i = 0; i != n; ++i) {
+      Checker.cache.Clear();
+      Tree type;
+      IntSink = Checker.Infer (Context(), TextTerm, type);
+   }
+}
+
+static void EncodeDerive (unsigned long n)
+{
+   for (unsigned long i = 0; i != n; ++i) {
+      Bits bits;
+      bits.push_back (false);
+      Tree type;
+      Generate (bits, Context(), TextTerm, type);
+      Sink = Derive (BitsToTree (bits)).Left();
+   }
+}
+
+struct Benchmark
+{
+   const char * name;
+   void (*run) (unsigned long n);
+};
+
+static const Benchmark Benchmarks[] = {
+   { "intern/pair-hit", PairHit },
+   { "intern/pair-miss", PairMiss },
+   { "arith/increment", Increment },
+   { "arith/decrement", Decrement },
+   { "arith/halve", Halve },
+   { "arith/to-int", ToInt },
+   { "pure/subst-lift", SubstLift },
+   { "pure/apply", ApplyPower },
+   { "pure/derive-twice", DeriveTwice },
+   { "pure/derive-small", DeriveSmall },
+   { "parse/normalise-substitution", NormaliseSubstitution },
+   { "parse/normalise-evaluation", NormaliseEvaluation },
+   { "parse/normalise-explicit", NormaliseExplicit },
+   { "parse/normalised-equals", Equals },
+   { "parse/generate", GenerateTwice },
+   { "parse/generate-deep", GenerateDeep },
+   { "parse/generate-deep-memo", GenerateDeepMemo },
+   { "parse/generate-shortest-deep", GenerateShortestDeep },
+   { "parse/typecheck", TypeCheck },
+   { "parse/encode-derive", EncodeDerive },
+   { "parse/parse-term", ParseText },
+   { "parse/batch-parse", BatchParseText },
+};
+
+struct Result
+{
+   unsigned long ops;
+   double ns;
+   unsigned long long allocations;
+   size_t nodes;
+};
+
+static Result Measure (const Benchmark & b, double minNs)
+{
+   // One untimed pass over the inputs first, so that what is interned once
+   // and then reused is not counted against the rest.
+   b.run (Cycle);
+
+   Result r;
+   for (r.ops = 1; ; r.ops *= 2) {
+      unsigned long long allocations = Allocations;
+      size_t nodes = NodeCount();
+      std::chrono::steady_clock::time_point start =
+         std::chrono::steady_clock::now();
+      b.run (r.ops);
+      r.ns = std::chrono::duration <double, std::nano> (
+         std::chrono::steady_clock::now() - start).count();
+      r.allocations = Allocations - allocations;
+      r.nodes = NodeCount() - nodes;
+      if (r.ns >= minNs) {
+         return r;
+      }
+   }
+}
+
+// The build options, as in the Makefile.
+static const char * Options()
+{
+   return ""
+#ifdef INTERN_STDSET
+      " -DINTERN_STDSET"
+#endif
+#ifdef COMPACT_NODES
+      " -DCOMPACT_NODES"
+#endif
+#ifdef THREADS
+      " -DTHREADS"
+#endif
+#ifdef NODE_METADATA
+      " -DNODE_METADATA"
+#endif
+      ;
+}
+
+int main (int argc, const char * const * argv)
+{
+   bool json = false;
+   double minNs = 100e6;
+   const char * filter = "";
+   for (int i = 1; i != argc; ++i) {
+      if (strcmp (argv[i], "--json") == 0) {
+         json = true;
+      }
+      else if (i + 1 != argc && strcmp (argv[i], "--min-time") == 0) {
+         minNs = strtod (argv[++i], NULL) * 1e6;
+      }
+      else if (argv[i][0] != '-') {
+         filter = argv[i];
+      }
+      else {
+         std::cerr << "Usage: " << argv[0]
+                   << " [--json] [--min-time MS] [FILTER]\n";
+         return 1;
+      }
+   }
+
+   Setup();
+
+   if (json) {
+      std::cout << "{\n  \"options\": \"" << Options() << "\",\n"
+                << "  \"benchmarks\": [";
+   }
+   const char * separator = "\n";
+   for (size_t i = 0; i != sizeof Benchmarks / sizeof Benchmarks[0]; ++i) {
+      const Benchmark & b = Benchmarks[i];
+      if (strstr (b.name, filter) == NULL) {
+         continue;
+      }
+      Result r = Measure (b, minNs);
+      double ns = r.ns / r.ops;
+      double allocations = double (r.allocations) / r.ops;
+      double nodes = double (r.nodes) / r.ops;
+      if (json) {
+         std::cout << separator << "    { \"name\": \"" << b.name
+                   << "\", \"ops\": " << r.ops
+                   << ", \"ns_per_op\": " << ns
+                   << ", \"allocs_per_op\": " << allocations
+                   << ", \"nodes_per_op\": " << nodes << " }";
+         separator = ",\n";
+      }
+      else {
+         std::cout.width (32);
+         std::cout << std::left << b.name << ' ' << ns << " ns/op, "
+                   << allocations << " allocs/op, "
+                   << nodes << " nodes/op\n";
+      }
+   }
+   if (json) {
+      std::cout << "\n  ]\n}\n";
+   }
+   return 0;
+}
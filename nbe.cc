@@ -0,0 +1,209 @@
+
+// Normalisation by evaluation.
+
+#include "nbe.hh"
+
+#include <deque>
+
+struct Value;
+
+// An environment: the values of the variables VAR 0, VAR 1, ...
+struct Env
+{
+   Value * head;
+   const Env * tail;
+};
+
+struct Value
+{
+   // PI, LAMBDA and APPLY have the same numbers as their opcodes.
+   enum Kind {
+      PI,
+      LAMBDA,
+      APPLY,                    // Stuck: function is not a LAMBDA.
+      VAR,
+      CONSTANT                  // STAR or BOX.
+   };
+
+   Kind kind;
+
+   // PI and LAMBDA: the domain, and the body closed over env.
+   Value * domain;
+   const Env * env;
+   Tree body;
+
+   // APPLY.
+   Value * function;
+   Value * argument;
+
+   // VAR.  Levels count binders from the outside, so need no adjusting as
+   // we go under binders.  Variables free in the term being normalised have
+   // negative levels: VAR n, outside of everything, has level -1 - n.
+   long level;
+
+   // CONSTANT.
+   Tree constant;
+};
+
+// Owns the values and environments for one normalisation.
+class Evaluator
+{
+public:
+   Value * Eval (const Env * env, Tree t);
+   Tree ReadBack (long depth, const Value * v);
+   bool Equal (long depth, const Value * a, const Value * b);
+
+private:
+   Value * New (Value::Kind kind);
+   Value * Var (long level);
+   const Env * Extend (const Env * env, Value * v);
+   Value * Apply (Value * f, Value * a);
+
+   // The body of a PI or LAMBDA, with its variable at the given level.
+   Value * Instantiate (const Value * binder, long level);
+
+   std::deque <Value> values;
+   std::deque <Env> envs;
+};
+
+Value * Evaluator::New (Value::Kind kind)
+{
+   values.push_back (Value());
+   Value * v = &values.back();
+   v->kind = kind;
+   return v;
+}
+
+Value * Evaluator::Var (long level)
+{
+   Value * v = New (Value::VAR);
+   v->level = level;
+   return v;
+}
+
+const Env * Evaluator::Extend (const Env * env, Value * v)
+{
+   Env e = { v, env };
+   envs.push_back (e);
+   return &envs.back();
+}
+
+Value * Evaluator::Eval (const Env * env, Tree t)
+{
+   int opcode = t.Left().ToInt();
+
+   if (opcode < 2) {
+      // PI or LAMBDA.
+      Value * v = New (Value::Kind (opcode));
+      v->domain = Eval (env, t.Right().Left());
+      v->env = env;
+      v->body = t.Right().Right();
+      return v;
+   }
+
+   if (opcode == 2) {
+      Value * f = Eval (env, t.Right().Left());
+      return Apply (f, Eval (env, t.Right().Right()));
+   }
+
+   if (opcode == 3) {
+      Value * v = New (Value::CONSTANT);
+      v->constant = t;
+      return v;
+   }
+
+   // A variable: look it up, or else it's free.
+   size_t n = (opcode - 4) / 2;
+   for (const Env * e = env; e; e = e->tail, --n) {
+      if (n == 0) {
+         return e->head;
+      }
+   }
+   return Var (-1 - (long) n);
+}
+
+Value * Evaluator::Apply (Value * f, Value * a)
+{
+   if (f->kind == Value::LAMBDA) {
+      return Eval (Extend (f->env, a), f->body);
+   }
+
+   Value * v = New (Value::APPLY);
+   v->function = f;
+   v->argument = a;
+   return v;
+}
+
+Value * Evaluator::Instantiate (const Value * binder, long level)
+{
+   return Eval (Extend (binder->env, Var (level)), binder->body);
+}
+
+Tree Evaluator::ReadBack (long depth, const Value * v)
+{
+   switch (v->kind) {
+   case Value::PI:
+   case Value::LAMBDA:
+      return Pair (int (v->kind),
+                   Pair (ReadBack (depth, v->domain),
+                         ReadBack (depth + 1, Instantiate (v, depth))));
+
+   case Value::APPLY:
+      return Pair (2, Pair (ReadBack (depth, v->function),
+                            ReadBack (depth, v->argument)));
+
+   case Value::VAR:
+      // Bound or free, the index is the number of binders in between.
+      return Pair (int (4 + 2 * (depth - 1 - v->level)), 0);
+
+   case Value::CONSTANT:
+      return v->constant;
+   }
+
+   assert (false);
+   return 0;
+}
+
+bool Evaluator::Equal (long depth, const Value * a, const Value * b)
+{
+   if (a->kind != b->kind) {
+      return false;
+   }
+
+   switch (a->kind) {
+   case Value::PI:
+   case Value::LAMBDA:
+      return Equal (depth, a->domain, b->domain)
+         &&  Equal (depth + 1,
+                    Instantiate (a, depth), Instantiate (b, depth));
+
+   case Value::APPLY:
+      return Equal (depth, a->function, b->function)
+         &&  Equal (depth, a->argument, b->argument);
+
+   case Value::VAR:
+      return a->level == b->level;
+
+   case Value::CONSTANT:
+      return a->constant == b->constant;
+   }
+
+   assert (false);
+   return false;
+}
+
+Tree NbeNormalise (Tree t)
+{
+   Evaluator evaluator;
+   return evaluator.ReadBack (0, evaluator.Eval (NULL, t));
+}
+
+bool NbeEquals (Tree a, Tree b)
+{
+   if (a == b) {
+      return true;
+   }
+   Evaluator evaluator;
+   return evaluator.Equal (0, evaluator.Eval (NULL, a),
+                           evaluator.Eval (NULL, b));
+}
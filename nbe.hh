@@ -0,0 +1,19 @@
+#ifndef NBE_HH_
+#define NBE_HH_
+
+// Normalisation by evaluation.  Rather than substituting into syntax, a term
+// is evaluated to a semantic value, in which a LAMBDA or PI is a closure of
+// its body and the environment it was evaluated in, and the normal form is
+// then read back from the value.  Nothing is ever substituted, so nothing is
+// ever lifted under a binder either.
+
+#include "tree.hh"
+
+// The (beta) normal form of t.  Free variables of t are left free.
+Tree NbeNormalise (Tree t);
+
+// Whether a and b have the same normal form.  This compares the values
+// directly, stopping at the first difference.
+bool NbeEquals (Tree a, Tree b);
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef PAIRING_HH_
+#define PAIRING_HH_
+
+// The pairing of pair.c, Pair (l, r) = (2l + 1) << r, on native unsigned
+// integers, for when the numbers are small enough not to need Trees.  pair.c
+// finds Right() by recursing once per trailing zero; here we count the zeros
+// with the compiler's intrinsics.  The Word type can be uint32_t, uint64_t or
+// unsigned __int128.  Zero is not a pair (it is the null tree), and
+// NativeLeft() and NativeRight() must not be given it.
+
+#include <stddef.h>
+#include <stdint.h>
+
+inline unsigned CountTrailingZeros (uint32_t x)
+{
+   return __builtin_ctz (x);
+}
+
+inline unsigned CountTrailingZeros (uint64_t x)
+{
+   return __builtin_ctzll (x);
+}
+
+inline unsigned CountTrailingZeros (unsigned __int128 x)
+{
+   uint64_t low = x;
+   return low != 0 ? __builtin_ctzll (low)
+      : 64 + __builtin_ctzll (uint64_t (x >> 64));
+}
+
+template <typename Word>
+inline Word NativeRight (Word x)
+{
+   return CountTrailingZeros (x);
+}
+
+template <typename Word>
+inline Word NativeLeft (Word x)
+{
+   return x >> CountTrailingZeros (x) >> 1;
+}
+
+// Set 'result' to Pair (l, r), returning false (and leaving 'result' alone)
+// if that doesn't fit in a Word.
+template <typename Word>
+inline bool NativePair (Word l, Word r, Word & result)
+{
+   const Word bits = sizeof (Word) * 8;
+   if (r >= bits || l > Word (~Word (0)) >> r >> 1) {
+      return false;
+   }
+   result = (2 * l + 1) << r;
+   return true;
+}
+
+// The batch versions.  These are written without branches in the loops, so
+// that the compiler can vectorise them.
+
+// out[i] = Pair (l[i], r[i]), for i < n.  Returns the number of pairs that
+// overflowed; their out[i] are zero.
+template <typename Word>
+size_t NativePairs (const Word * l, const Word * r, Word * out, size_t n)
+{
+   const Word bits = sizeof (Word) * 8;
+   size_t overflows = 0;
+   for (size_t i = 0; i != n; ++i) {
+      Word shift = r[i] < bits ? r[i] : 0;
+      bool fits = r[i] < bits && l[i] <= Word (~Word (0)) >> shift >> 1;
+      out[i] = fits ? (2 * l[i] + 1) << shift : 0;
+      overflows += !fits;
+   }
+   return overflows;
+}
+
+// l[i] = Left (x[i]), r[i] = Right (x[i]), for i < n.  A zero x[i] gives
+// zeros.
+template <typename Word>
+void NativeUnpairs (const Word * x, Word * l, Word * r, size_t n)
+{
+   const Word top = Word (1) << (sizeof (Word) * 8 - 1);
+   for (size_t i = 0; i != n; ++i) {
+      // Or-ing in the top bit keeps the count defined for zero, and doesn't
+      // change it otherwise.
+      unsigned zeros = CountTrailingZeros (Word (x[i] | top));
+      l[i] = x[i] >> zeros >> 1;
+      r[i] = x[i] != 0 ? zeros : 0;
+   }
+}
+
+#endif
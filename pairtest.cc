@@ -1,12 +1,117 @@
 #include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "pairing.hh"
 
 int Pair (int, int);
 int Left (int);
 int Right (int);
 extern int lastRight;
 
-int main()
+// Check pairing.hh against pair.c on every x in [first, last).  Each x is a
+// pair (l, r), and pair.c is right about it.
+static void CheckRange (uint32_t first, uint32_t last)
+{
+   const size_t block = 1024;
+   uint32_t xs[block], ls[block], rs[block], pairs[block];
+   uint64_t xs64[block], ls64[block], rs64[block];
+   for (uint32_t x = first; x < last; ) {
+      size_t n = 0;
+      for (; n != block && x < last; ++n, ++x) {
+         int l = Left (x);
+         int r = lastRight;
+         assert (Pair (l, r) == int (x));
+         assert (NativeLeft (x) == uint32_t (l));
+         assert (NativeRight (x) == uint32_t (r));
+         assert (NativeLeft (uint64_t (x)) == uint64_t (l));
+         assert (NativeRight (uint64_t (x)) == uint64_t (r));
+         assert (NativeLeft ((unsigned __int128) x) == (unsigned) l);
+         assert (NativeRight ((unsigned __int128) x) == (unsigned) r);
+         uint32_t p;
+         assert (NativePair (uint32_t (l), uint32_t (r), p) && p == x);
+         xs[n] = x;
+         xs64[n] = uint64_t (x) << 32;
+      }
+
+      // The batch kernels agree, and so does the 64 bit pairing on x << 32.
+      NativeUnpairs (xs, ls, rs, n);
+      assert (NativePairs (ls, rs, pairs, n) == 0);
+      NativeUnpairs (xs64, ls64, rs64, n);
+      for (size_t i = 0; i != n; ++i) {
+         assert (ls[i] == NativeLeft (xs[i]) && rs[i] == NativeRight (xs[i]));
+         assert (pairs[i] == xs[i]);
+         assert (ls64[i] == ls[i] && rs64[i] == rs[i] + 32);
+      }
+   }
+}
+
+// Check the overflow detection at the edges, for each shift.
+template <typename Word>
+static void CheckOverflow()
+{
+   const unsigned bits = sizeof (Word) * 8;
+   const Word max = ~Word (0);
+   Word p = 0;
+   for (unsigned r = 0; r != bits; ++r) {
+      Word l = max >> r >> 1;
+      assert (NativePair (l, Word (r), p));
+      assert (NativeLeft (p) == l && NativeRight (p) == r);
+      assert (!NativePair (Word (l + 1), Word (r), p));
+   }
+   assert (!NativePair (Word (0), Word (bits), p));
+
+   Word ls[] = { 0, max >> 1, Word (max >> 1) + 1, 5, 0 };
+   Word rs[] = { Word (bits - 1), 0, 0, Word (bits), 3 };
+   Word out[5];
+   assert (NativePairs (ls, rs, out, 5) == 2);
+   assert (out[0] == Word (1) << (bits - 1) && out[1] == max);
+   assert (out[2] == 0 && out[3] == 0 && out[4] == 8);
+
+   Word zero = 0, l = 1, r = 1;
+   NativeUnpairs (&zero, &l, &r, 1);
+   assert (l == 0 && r == 0);
+}
+
+// Check [1, last) split between processes, one per core.  (Processes rather
+// than threads, because pair.c keeps lastRight in a global.)
+static bool CheckInParallel (uint32_t last)
 {
+   long cores = sysconf (_SC_NPROCESSORS_ONLN);
+   if (cores < 1) {
+      cores = 1;
+   }
+   for (long i = 0; i != cores; ++i) {
+      uint32_t first = 1 + uint64_t (last - 1) * i / cores;
+      uint32_t end = 1 + uint64_t (last - 1) * (i + 1) / cores;
+      pid_t pid = fork();
+      if (pid == 0) {
+         CheckRange (first, end);
+         _exit (0);
+      }
+      if (pid < 0) {
+         perror ("fork");
+         return false;
+      }
+   }
+
+   bool ok = true;
+   int status;
+   while (wait (&status) > 0) {
+      ok = ok && WIFEXITED (status) && WEXITSTATUS (status) == 0;
+   }
+   return ok;
+}
+
+// Usage: pairtest [--exhaustive]
+// With --exhaustive, check every positive int, which takes a while; by
+// default, those below 2^22.
+int main (int argc, const char * const * argv)
+{
+   bool exhaustive = argc == 2 && strcmp (argv[1], "--exhaustive") == 0;
+
    for (int i = 0; i != 256; ++i) {
       for (int j = 0; j != 16; ++j) {
          int p = Pair (i, j);
@@ -17,5 +122,14 @@ int main()
    for (int i = 1; i != 1000000; ++i) {
       assert (i == Pair (Left (i), Right (i)));
    }
+
+   CheckOverflow <uint32_t>();
+   CheckOverflow <uint64_t>();
+   CheckOverflow <unsigned __int128>();
+
+   if (!CheckInParallel (exhaustive ? 0x80000000u : 1u << 22)) {
+      fprintf (stderr, "pairing.hh disagrees with pair.c\n");
+      return 1;
+   }
    return 0;
 }
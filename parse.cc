@@ -14,8 +14,17 @@
 // a (x:b) c d = a ((x:b) (c d))
 // a b>c d = a (b>(c d))
 
+#include "batchparse.hh"
 #include "bitstream.hh"
+#include "esubst.hh"
+#include "nbe.hh"
 #include "parse.hh"
+#include "typecheck.hh"
+
+#include <fstream>
+#include <string.h>
+
+NormaliseEngine Engine = SUBSTITUTION;
 
 const char * ParseTerm (Tree & term,
                         const VarList & context,
@@ -124,6 +133,17 @@ const char * CheckChar (char c, const char * input)
 
 Tree Subst (Tree main, int var, Tree replace)
 {
+   if (Engine == EXPLICIT && var == 0) {
+      return EsSubst (main, replace);
+   }
+
+#ifdef NODE_METADATA
+   // Nothing to do if main doesn't mention var or above.
+   if (main.FreeTop() < 4 + 2 * var) {
+      return main;
+   }
+#endif
+
    int opcode = main.Left().ToInt();
    if (opcode == 0 || opcode == 1) {
       // PI or LAMBDA
@@ -152,6 +172,12 @@ Tree Subst (Tree main, int var, Tree replace)
 
 Tree Lift (Tree t, int var)
 {
+#ifdef NODE_METADATA
+   if (t.FreeTop() < 4 + 2 * var) {
+      return t;
+   }
+#endif
+
    int opcode = t.Left().ToInt();
    if (opcode == 0 || opcode == 1) {
       // PI or LAMBDA
@@ -175,6 +201,13 @@ Tree Lift (Tree t, int var)
 
 Tree WeakHeadNormalise (Tree t)
 {
+   if (Engine == EVALUATION) {
+      return NbeNormalise (t);
+   }
+   if (Engine == EXPLICIT) {
+      return EsWeakHeadNormalise (t);
+   }
+
    while (t.Left() == 2) {
       Tree left = WeakHeadNormalise (t.Right().Left());
       if (left.Left() != 1) {
@@ -188,6 +221,13 @@ Tree WeakHeadNormalise (Tree t)
 
 Tree Normalise (Tree t)
 {
+   if (Engine == EVALUATION) {
+      return NbeNormalise (t);
+   }
+   if (Engine == EXPLICIT) {
+      return EsNormalise (t);
+   }
+
    while (t.Left() == 2) {
       Tree left = Normalise (t.Right().Left());
       if (left.Left() != 1) { // not a lambda.
@@ -206,6 +246,13 @@ Tree Normalise (Tree t)
 
 bool NormalisedEquals (Tree a, Tree b)
 {
+   if (Engine == EVALUATION) {
+      return NbeEquals (a, b);
+   }
+   if (Engine == EXPLICIT) {
+      return EsEquals (a, b);
+   }
+
    if (a == b) {
       return true;
    }
@@ -246,11 +293,173 @@ const char * ParseVariable (std::string & var, const char * input)
    return input;
 }
 
+#ifndef NO_PARSE_MAIN
+
+// Use GenerateShortest() rather than Generate().
+static bool UseShortest;
+
+// Type check with TypeChecker, rather than through Generate() and Derive.
+static bool UseChecker;
+
+// Generate the bits for term, in the empty context, with the leading zero.
+static void Encode (Bits & bits, Tree term, Tree & type)
+{
+   bits.push_back (false);
+   if (UseShortest) {
+      GenerateShortest (bits, Context(), term, type);
+   }
+   else {
+      Generate (bits, Context(), term, type);
+   }
+}
+
+// Report how much shorter the shortest encodings are than Generate()'s.
+static void ReportSavings (size_t shortest, size_t generated)
+{
+   std::cout << "Shortest encoding " << shortest << " bits, Generate's "
+             << generated << " bits";
+   if (generated != 0) {
+      std::cout << " (" << 100.0 * (generated - shortest) / generated
+                << "% shorter)";
+   }
+   std::cout << ".\n";
+}
+
+// The checks main() makes of one term, for each line of 'path' (- for the
+// standard input), parsed with BatchParser.  Blank lines are skipped.  Reports
+// the lines that fail, including those that don't parse or type check, and
+// returns the number of them.  With UseShortest, also reports the savings over
+// all the terms.  With UseChecker, only type check.
+static unsigned long Batch (const char * path)
+{
+   std::ifstream file;
+   if (strcmp (path, "-") != 0) {
+      file.open (path);
+      if (!file) {
+         std::cerr << "Cannot open " << path << '\n';
+         return 1;
+      }
+   }
+   std::istream & input = file.is_open() ? file : std::cin;
+
+   BatchParser parser;
+   SourcePositions positions;
+   parser.positions = &positions;
+   TypeChecker checker;
+   std::string line;
+   Bits bits;
+   unsigned long number = 0;
+   unsigned long terms = 0;
+   unsigned long failed = 0;
+   size_t shortest = 0;
+   size_t generated = 0;
+   while (std::getline (input, line)) {
+      ++number;
+      const char * text = line.c_str();
+      if (*SkipWhite (text) == 0) {
+         continue;
+      }
+      ++terms;
+
+      Tree term;
+      BatchParser::Error error = parser.Parse (text, term);
+      if (error != BatchParser::OK) {
+         parser.Report (std::cerr << path << ':' << number << ": ",
+                        error, text) << ".\n";
+         ++failed;
+         continue;
+      }
+
+      // Generate() can only encode well typed terms.
+      Tree checked;
+      TypeChecker::Error checkError = checker.Infer (Context(), term, checked);
+      if (checkError != TypeChecker::OK) {
+         checker.Report (std::cerr << path << ':' << number << ": ",
+                         checkError, &positions) << ".\n";
+         ++failed;
+         continue;
+      }
+      if (UseChecker) {
+         continue;
+      }
+
+      bits.clear();
+      Tree type;
+      Encode (bits, term, type);
+      if (UseShortest) {
+         Bits plain;
+         Tree plainType;
+         Generate (plain, Context(), term, plainType);
+         shortest += bits.size() - 1;
+         generated += plain.size();
+      }
+      Tree judgment = Derive (BitsToTree (bits)).Left();
+      if (!(Normalise (term) == judgment.Left())
+          || !(Normalise (type) == judgment.Right().Left())
+          || !judgment.Right().Right().Left().IsNull()
+          || !judgment.Right().Right().Right().IsNull()) {
+         std::cerr << path << ':' << number << ": Derive gave ";
+         PrintDerived (std::cerr, Derive (BitsToTree (bits))) << '\n';
+         ++failed;
+      }
+      else if (!NormalisedEquals (checked, type)) {
+         std::cerr << path << ':' << number << ": TypeChecker disagrees\n";
+         ++failed;
+      }
+   }
+
+   std::cout << terms << " terms, " << failed << " failed.\n";
+   if (UseShortest) {
+      ReportSavings (shortest, generated);
+   }
+   return failed;
+}
+
+// Usage: parse [--nbe | --explicit] [--shortest | --check] TERM
+//        parse [--nbe | --explicit] [--shortest | --check] --batch FILE
+// Prints the term, its type, the bitstream that Derive turns into it, and what
+// Derive does with that, checking the last against the term and type
+// normalised by the engine chosen, and the type against TypeChecker's.  A term
+// that TypeChecker rejects is reported, and goes no further.  With --batch,
+// checks each line of FILE (see Batch()) without printing.  With --shortest,
+// the bitstream is from GenerateShortest(), and we report how much shorter it
+// is than Generate()'s.  With --check, only type check, with TypeChecker,
+// printing the type or what is wrong.
 int main (int argc, const char *const * argv)
 {
+   int arg = 1;
+   if (arg < argc && strcmp (argv[arg], "--nbe") == 0) {
+      Engine = EVALUATION;
+      ++arg;
+   }
+   else if (arg < argc && strcmp (argv[arg], "--explicit") == 0) {
+      Engine = EXPLICIT;
+      ++arg;
+   }
+   if (arg < argc && strcmp (argv[arg], "--shortest") == 0) {
+      UseShortest = true;
+      ++arg;
+   }
+   else if (arg < argc && strcmp (argv[arg], "--check") == 0) {
+      UseChecker = true;
+      ++arg;
+   }
+   if (arg + 2 == argc && strcmp (argv[arg], "--batch") == 0) {
+      return Batch (argv[arg + 1]) != 0;
+   }
+   if (arg + 1 != argc) {
+      std::cerr << "Usage: " << argv[0]
+                << " [--nbe | --explicit] [--shortest | --check] TERM\n"
+                << "       " << argv[0]
+                << " [--nbe | --explicit] [--shortest | --check]"
+                << " --batch FILE\n";
+      return 1;
+   }
+   const char * text = argv[arg];
+
    Tree term;
    try {
-      const char * input = ParseTerm (term, VarList(), argv[1]);
+      const char * input = ParseTerm (term, VarList(), text);
       if (*SkipWhite (input) != 0) {
          std::cerr << "Unexpected text after end...\n";
          return 1;
@@ -258,34 +467,57 @@ int main (int argc, const char *const * argv)
    }
    catch (const CharNotFound & c) {
       std::cerr << "Expected '" << c.Char << "' at position "
-                << c.Input - argv[1] << ".\n";
+                << c.Input - text << ".\n";
       return 1;
    }
    std::cout << term << std::endl;
 
+   TypeChecker checker;
+   Tree checked;
+   TypeChecker::Error checkError = checker.Infer (Context(), term, checked);
+   if (checkError != TypeChecker::OK) {
+      // BatchParser knows where the subterms were.  Generate() can only
+      // encode well typed terms, so stop here.
+      BatchParser parser;
+      SourcePositions positions;
+      parser.positions = &positions;
+      Tree again;
+      parser.Parse (text, again);
+      checker.Report (std::cerr, checkError, &positions) << ".\n";
+      return 1;
+   }
+   if (UseChecker) {
+      std::cout << checked << std::endl;
+      return 0;
+   }
+
    Bits bits;
-   bits.push_back (false);
    Tree type;
-   Generate (bits, Context(), term, type);
+   Encode (bits, term, type);
    std::cout << type << std::endl;
 
    // Now convert to a Tree...
-   Tree bt = 0;
-   for (Bits::reverse_iterator i = bits.rbegin(); i != bits.rend(); ++i) {
-      std::cout << *i;
-      bt = bt.Double();
-      if (*i) {
-         bt = bt.Increment();
-      }
+   for (size_t i = bits.size(); i-- != 0; ) {
+      std::cout << bits[i];
    }
-
    std::cout << std::endl;
 
+   Tree bt = BitsToTree (bits);
+
+   // Converting back gives the same bits, less the leading zeros.
+   Bits back;
+   TreeToBits (back, bt);
+   assert (back.size() <= bits.size());
+   for (size_t i = 0; i != bits.size(); ++i) {
+      assert (bits[i] == (i < back.size() && back[i]));
+   }
+
    Tree output = Derive (bt);
 
    PrintDerived (std::cout, output);
 
-   // Check the returned term.
+   // Check the returned term.  Derive normalises with pure.c's Subst and
+   // Apply, so this cross-checks the engine.
    assert (Normalise (term) == output.Left().Left());
    // Check the returned type.
    assert (Normalise (type) == output.Left().Right().Left());
@@ -293,6 +525,18 @@ int main (int argc, const char *const * argv)
    assert (output.Left().Right().Right().Left().IsNull());
    // Check that the context is empty.
    assert (output.Left().Right().Right().Right().IsNull());
+   // Check TypeChecker agrees.
+   assert (NormalisedEquals (checked, type));
+
+   if (UseShortest) {
+      Bits plain;
+      Tree plainType;
+      Generate (plain, Context(), term, plainType);
+      assert (bits.size() - 1 <= plain.size());
+      ReportSavings (bits.size() - 1, plain.size());
+   }
 
    return 0;
 }
+
+#endif
@@ -69,6 +69,19 @@ Tree Subst (Tree main, int var, Tree replace);
 
 Tree Lift (Tree t, int var);
 
+// Which engine WeakHeadNormalise, Normalise and NormalisedEquals use:
+// syntactic substitution, normalisation by evaluation (see nbe.hh), or
+// explicit substitutions (see esubst.hh).  Evaluation gives the full normal
+// form for WeakHeadNormalise.  Explicit substitutions are also used for
+// Subst (main, 0, replace).
+enum NormaliseEngine {
+   SUBSTITUTION,
+   EVALUATION,
+   EXPLICIT
+};
+
+extern NormaliseEngine Engine;
+
 Tree WeakHeadNormalise (Tree t);
 
 Tree Normalise (Tree t);
@@ -0,0 +1,214 @@
+// Checks of parse's encoding of terms as bitstreams: the packed Bits and their
+// conversion to and from Trees, Generate() in non-empty contexts and with its
+// memo, and GenerateShortest().
+
+#include "bitstream.hh"
+
+#include <stdint.h>
+#include <vector>
+
+// Well typed terms in the empty context.  Under their leading LAMBDAs, their
+// bodies are terms in non-empty contexts.
+static const char * const Terms[] = {
+   "[P:*][x:P]x",
+   "{A:*}A>A",
+   "[P:*][f:P>P][x:P]f (f x)",
+   "[P:*][y:P]([x:P]x) y",
+   "[A:*][B:*][f:A>B][x:A]f x",
+   "[A:*][B:*][C:*][f:A>B>C][x:B][y:A]f y x",
+   "[A:*][B:{x:A}*][f:{x:A}B x][a:A]f a",
+   "[A:*][B:{x:A}*][f:{x:A}B x][a:A][g:A>A>A]f (g a (g a a))",
+   "[T:*][a1:T][a2:T][a3:T][a4:T][a5:T][a6:T][a7:T][a8:T]a1",
+   "[P:*][f:{Q:*}Q>Q][x:P]f P (f P x)",
+};
+static const size_t TermCount = sizeof Terms / sizeof Terms[0];
+
+static Tree Parse (const char * text)
+{
+   Tree term;
+   const char * rest = ParseTerm (term, VarList(), text);
+   assert (*SkipWhite (rest) == 0);
+   return term;
+}
+
+// Derive the bits (from Generate() in context, less the leading zero), and
+// check that it gives back context |- term : type, up to normalisation.
+static void CheckDerived (const Bits & bits, const Context & context,
+                          Tree term, Tree type)
+{
+   Bits stream;
+   stream.push_back (false);
+   stream.Append (bits, 0, bits.size());
+   Tree judgment = Derive (BitsToTree (stream)).Left();
+   assert (judgment.Left() == Normalise (term));
+   assert (NormalisedEquals (judgment.Right().Left(), type));
+   assert (judgment.Right().Right().Left().IsNull());
+   assert (judgment.Right().Right().Right() == context.list);
+}
+
+// The same pseudo-random bits every run.
+static uint64_t Seed = 1;
+
+static bool RandomBit()
+{
+   Seed = Seed * 6364136223846793005u + 1442695040888963407u;
+   return Seed >> 63;
+}
+
+// The number with the given bits, by Tree arithmetic.
+static Tree Number (const Bits & bits)
+{
+   Tree t = 0;
+   for (size_t i = bits.size(); i-- != 0; ) {
+      t = t.Double();
+      if (bits[i]) {
+         t = t.Increment();
+      }
+   }
+   return t;
+}
+
+// BitsToTree and TreeToBits round trip, at every length up to a few words.
+// The top bit is sometimes clear, so that there are leading zeros to drop.
+static void CheckConversion()
+{
+   for (size_t length = 0; length != 200; ++length) {
+      for (int repeat = 0; repeat != 4; ++repeat) {
+         Bits bits;
+         for (size_t i = 0; i != length; ++i) {
+            bits.push_back (RandomBit());
+         }
+         Tree t = BitsToTree (bits);
+         assert (t == Number (bits));
+
+         Bits back;
+         TreeToBits (back, t);
+         size_t top = length;
+         while (top != 0 && !bits[top - 1]) {
+            --top;
+         }
+         assert (back.size() == top);
+         for (size_t i = 0; i != top; ++i) {
+            assert (back[i] == bits[i]);
+         }
+
+         // Append, from any offset, is the same as pushing bit by bit.
+         size_t first = length / 3;
+         Bits appended;
+         appended.push_back (true);
+         appended.Append (bits, first, length);
+         assert (appended.size() == 1 + length - first);
+         for (size_t i = first; i != length; ++i) {
+            assert (appended[1 + i - first] == bits[i]);
+         }
+      }
+   }
+}
+
+// Generate() in a context built up with Push(), with push_back(), and from a
+// list paired up by hand, is all the same, and Derive agrees.
+static void CheckContexts()
+{
+   for (size_t i = 0; i != TermCount; ++i) {
+      Tree term = Parse (Terms[i]);
+      Context pushed;
+      Context appended;
+      std::vector <Tree> domains;
+      for (;;) {
+         Bits bits;
+         Tree type;
+         Generate (bits, pushed, term, type);
+         CheckDerived (bits, pushed, term, type);
+
+         Tree list = 0;
+         for (size_t j = 0; j != domains.size(); ++j) {
+            list = Pair (domains[j], list);
+         }
+         assert (appended == pushed && Context (list) == pushed);
+         assert (Context (list).size() == domains.size());
+
+         Bits again;
+         Tree againType;
+         Generate (again, Context (list), term, againType);
+         assert (again.Words() == bits.Words() && againType == type);
+
+         if (!(term.Left() == 1)) {
+            break;
+         }
+         // Go under the LAMBDA.
+         domains.push_back (term.Right().Left());
+         pushed = pushed.Push (term.Right().Left());
+         appended.push_back (term.Right().Left());
+         term = term.Right().Right();
+      }
+   }
+}
+
+// Generate() gives the same bits with its memo off, small (so that it is
+// cleared as it goes), and large, whether the bits are spliced from the memo
+// at a word boundary or not.
+static void CheckMemo()
+{
+   const size_t saved = GenerateMemoBits;
+   const size_t sizes[] = { 0, 100, saved };
+   for (size_t i = 0; i != TermCount; ++i) {
+      Tree term = Parse (Terms[i]);
+      GenerateMemoBits = 0;
+      Bits plain;
+      Tree plainType;
+      Generate (plain, Context(), term, plainType);
+
+      for (size_t s = 0; s != sizeof sizes / sizeof sizes[0]; ++s) {
+         GenerateMemoBits = sizes[s];
+         for (size_t offset = 0; offset < 70; offset += 23) {
+            for (int repeat = 0; repeat != 2; ++repeat) {
+               Bits bits;
+               for (size_t j = 0; j != offset; ++j) {
+                  bits.push_back (j % 3 == 0);
+               }
+               Tree type;
+               Generate (bits, Context(), term, type);
+               assert (type == plainType);
+               assert (bits.size() == offset + plain.size());
+               for (size_t j = 0; j != plain.size(); ++j) {
+                  assert (bits[offset + j] == plain[j]);
+               }
+            }
+         }
+      }
+   }
+   GenerateMemoBits = saved;
+}
+
+// GenerateShortest() is never longer than Generate(), and Derive gives the same
+// judgment from its bits, in each context under the terms' LAMBDAs.
+static void CheckShortest()
+{
+   for (size_t i = 0; i != TermCount; ++i) {
+      Tree term = Parse (Terms[i]);
+      for (Context context; ; context = context.Push (term.Right().Left()),
+              term = term.Right().Right()) {
+         Bits plain;
+         Tree plainType;
+         Generate (plain, context, term, plainType);
+         Bits bits;
+         Tree type;
+         GenerateShortest (bits, context, term, type);
+         assert (bits.size() <= plain.size());
+         assert (NormalisedEquals (type, plainType));
+         CheckDerived (bits, context, term, type);
+         if (!(term.Left() == 1)) {
+            break;
+         }
+      }
+   }
+}
+
+int main()
+{
+   CheckConversion();
+   CheckContexts();
+   CheckMemo();
+   CheckShortest();
+   return 0;
+}
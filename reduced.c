@@ -0,0 +1,72 @@
+#define R { return
+#define P P (
+#define L L (
+#define T S (v, y, c,
+#define C ),
+#define X x)
+#define F );}
+
+int r, a;
+P y, X
+   R y - ~y << x;
+}
+Z (X
+   R r = x % 2 ? 0 : 1 + Z (x / 2 F
+L X
+   R x / 2 >> Z (x F
+#define U = S(4,13,-4,
+T  t)
+{
+   int
+      f = L t C         
+      x = r;
+   R
+         f - 2 ?
+         f > 2 ?
+         f - v ? t - (f > v) * c : y :
+         P f, P T  L X  C 
+                          S (v+2, t  U y C  c, Z (X )))
+         :
+         A (T  L X  C 
+                T  Z (X ) F
+}
+A (y, X
+   R L y) - 1
+      ? 5 << P y, X 
+      : S (4, x, 4, Z (r) F
+#define B (x /= 2) % 2 && (
+D (X 
+{
+   int
+      f,
+      d,
+      c = 0,
+      t = 7,
+      u = 14;
+   while (x && D (x - 1 C  B 1))
+      d = L L D (X ) C
+         f = L r C
+         x = L r C
+         c - r || (
+            L u) || L r) - f ||
+            B u = S (4, d, 4, r C 
+                   t = A (t, d) C
+            f / 2 & B  c = P d, c C 
+                              t  U t C 
+                              u  U u) )
+             C
+         c && B
+            t = P
+               ~u & 2 | B
+                  u = 1 << P L c C  u) C 
+               P L c C  t) C
+            c = r  C
+         u / 2 & B 
+            c = P t, c C 
+            u  U t C 
+            t = 9 );
+   R a = P P t, P u, P x, c)) C 
+                                a F
+}
+main ()
+   R D (D (D (D (D (99)))) F
@@ -0,0 +1,227 @@
+
+// Saving and loading binary snapshots of Trees.
+
+#include "snapshot.hh"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+
+static const char Magic[8] = { 'T', 'R', 'E', 'E', 'S', 'N', 'A', 'P' };
+static const unsigned long Version = 1;
+
+static void PutVarint (std::vector <unsigned char> & out, unsigned long long n)
+{
+   for (; n >= 128; n >>= 7) {
+      out.push_back (n & 127 | 128);
+   }
+   out.push_back (n);
+}
+
+// Returns false if the varint runs off the end.
+static bool GetVarint (const unsigned char * & p, const unsigned char * end,
+                       unsigned long long & n)
+{
+   n = 0;
+   for (int shift = 0; p != end && shift < 64; shift += 7) {
+      unsigned char byte = *p++;
+      n |= (unsigned long long) (byte & 127) << shift;
+      if (byte < 128) {
+         return true;
+      }
+   }
+   return false;
+}
+
+SnapshotWriter::SnapshotWriter() :
+   file (NULL),
+   nodes (0)
+{
+   AddRoots (VisitRoots, this);
+}
+
+SnapshotWriter::~SnapshotWriter()
+{
+   RemoveRoots (VisitRoots, this);
+   Close();
+}
+
+void SnapshotWriter::VisitRoots (RootVisitor visit, void * data)
+{
+   if (visit == NULL) {
+      static_cast <SnapshotWriter *> (data)->number.clear();
+   }
+}
+
+bool SnapshotWriter::Open (const char * p)
+{
+   Close();
+   path = p;
+   temporary = path + ".new";
+   number.clear();
+   nodes = 0;
+   file = fopen (temporary.c_str(), "wb");
+   return file != NULL;
+}
+
+bool SnapshotWriter::Write (const std::vector <Tree> & roots)
+{
+   if (file == NULL) {
+      return false;
+   }
+
+   // Number the new nodes in post-order, with an explicit stack as the DAG
+   // can be deep (see dag.cc).
+   number[NodeRef()] = 0;
+   unsigned long long first = nodes;
+   std::vector <unsigned char> body;
+   std::vector <Tree> stack;
+   for (size_t i = 0; i != roots.size(); ++i) {
+      stack.push_back (roots[i]);
+      while (!stack.empty()) {
+         Tree t = stack.back();
+         if (number.count (t.it) != 0) {
+            stack.pop_back();
+            continue;
+         }
+         std::unordered_map <NodeRef, unsigned long long>::const_iterator l =
+            number.find (t.Left().it);
+         std::unordered_map <NodeRef, unsigned long long>::const_iterator r =
+            number.find (t.Right().it);
+         if (l == number.end() || r == number.end()) {
+            if (l == number.end()) {
+               stack.push_back (t.Left());
+            }
+            if (r == number.end()) {
+               stack.push_back (t.Right());
+            }
+            continue;
+         }
+         unsigned long long n = ++nodes;
+         PutVarint (body, n - l->second);
+         PutVarint (body, n - r->second);
+         number[t.it] = n;
+         stack.pop_back();
+      }
+   }
+
+   std::vector <unsigned char> head (Magic, Magic + sizeof Magic);
+   PutVarint (head, Version);
+   PutVarint (head, nodes - first);
+   PutVarint (head, roots.size());
+   for (size_t i = 0; i != roots.size(); ++i) {
+      PutVarint (body, number[roots[i].it]);
+   }
+
+   if (fwrite (&head[0], head.size(), 1, file) != 1
+       || !body.empty() && fwrite (&body[0], body.size(), 1, file) != 1
+       || fflush (file) != 0 || fsync (fileno (file)) != 0) {
+      return false;
+   }
+   if (!temporary.empty()) {
+      if (rename (temporary.c_str(), path.c_str()) != 0) {
+         return false;
+      }
+      temporary.clear();
+   }
+   return true;
+}
+
+bool SnapshotWriter::Close()
+{
+   if (file == NULL) {
+      return true;
+   }
+   bool ok = fclose (file) == 0;
+   file = NULL;
+   if (!temporary.empty()) {
+      remove (temporary.c_str());
+      temporary.clear();
+   }
+   return ok;
+}
+
+bool SaveSnapshot (const char * path, const std::vector <Tree> & roots)
+{
+   SnapshotWriter writer;
+   bool ok = writer.Open (path) && writer.Write (roots);
+   return writer.Close() && ok;
+}
+
+// Intern the nodes of the segment at p, continuing the numbering in 'refs'.
+// Returns false, leaving 'refs' and 'roots' as they were, if it is incomplete.
+static bool LoadSegment (const unsigned char * & p, const unsigned char * end,
+                         std::vector <NodeRef> & refs,
+                         std::vector <Tree> & roots)
+{
+   const unsigned char * q = p;
+   if (end - q < (long) sizeof Magic || memcmp (q, Magic, sizeof Magic) != 0) {
+      return false;
+   }
+   q += sizeof Magic;
+
+   unsigned long long version, nodes, count;
+   if (!GetVarint (q, end, version) || version != Version
+       || !GetVarint (q, end, nodes) || !GetVarint (q, end, count)
+       || nodes > (unsigned long long) (end - q)) {
+      return false;
+   }
+
+   size_t old = refs.size();
+   unsigned long long last = old - 1 + nodes;
+   for (unsigned long long n = old; n <= last; ++n) {
+      unsigned long long l, r;
+      if (!GetVarint (q, end, l) || !GetVarint (q, end, r)
+          || l == 0 || l > n || r == 0 || r > n) {
+         refs.resize (old);
+         return false;
+      }
+      refs.push_back (Intern (refs[n - l], refs[n - r]));
+   }
+
+   std::vector <Tree> segmentRoots;
+   for (unsigned long long i = 0; i != count; ++i) {
+      unsigned long long n;
+      if (!GetVarint (q, end, n) || n > last) {
+         refs.resize (old);
+         return false;
+      }
+      segmentRoots.push_back (Tree::FromRef (refs[n]));
+   }
+
+   roots.swap (segmentRoots);
+   p = q;
+   return true;
+}
+
+bool LoadSnapshot (const char * path, std::vector <Tree> & roots)
+{
+   int fd = open (path, O_RDONLY);
+   if (fd < 0) {
+      return false;
+   }
+   struct stat st;
+   if (fstat (fd, &st) != 0 || st.st_size == 0) {
+      close (fd);
+      return false;
+   }
+   void * map = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   close (fd);
+   if (map == MAP_FAILED) {
+      return false;
+   }
+   madvise (map, st.st_size, MADV_SEQUENTIAL);
+
+   const unsigned char * p = static_cast <const unsigned char *> (map);
+   const unsigned char * end = p + st.st_size;
+   std::vector <NodeRef> refs (1);
+   bool ok = LoadSegment (p, end, refs, roots);
+   while (ok && p != end && LoadSegment (p, end, refs, roots)) {
+   }
+   munmap (map, st.st_size);
+   return ok;
+}
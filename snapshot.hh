@@ -0,0 +1,66 @@
+#ifndef SNAPSHOT_HH_
+#define SNAPSHOT_HH_
+
+// Binary snapshots of Trees, so that one process can pick up where another
+// left off, e.g., boot starting a stage from a saved bootstrap rather than
+// recomputing it.  Printing a Tree expands the DAG into a tree, which for the
+// output of Derive is hopeless; a snapshot holds each distinct node once.
+
+// A file is one or more segments.  Each is the magic "TREESNAP", then as
+// unsigned LEB128 varints: the version (1), the number of nodes and the
+// number of roots.  Then the nodes, each as its left and right children, in
+// an order where children come before their parents.  Nodes are numbered from
+// 1 across the whole file, with 0 the null tree, and a child is written as
+// the node's own number less the child's, which is usually small.  Last come
+// the numbers of the roots.  A later segment only holds the nodes that
+// earlier ones don't, and its roots replace theirs.
+
+#include "intern.hh"
+#include "tree.hh"
+
+#include <stdio.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Write the DAG under 'roots' to 'path'.  Returns false on an I/O error.
+bool SaveSnapshot (const char * path, const std::vector <Tree> & roots);
+
+// Map the file at 'path', and intern its nodes, replacing 'roots' with those
+// of the last segment.  A partly written last segment, e.g., from a process
+// killed while checkpointing, is ignored.  Returns false if the file can't be
+// read or has no complete segment.
+bool LoadSnapshot (const char * path, std::vector <Tree> & roots);
+
+// Writes a series of snapshots as the segments of one file, e.g., periodic
+// checkpoints of a long computation, so that each takes time in proportion
+// to what is new since the last.
+class SnapshotWriter
+{
+public:
+   SnapshotWriter();
+   ~SnapshotWriter();
+
+   // The file only replaces 'path' once the first segment is safely on disk,
+   // so an older file there survives a crash until then.
+   bool Open (const char * path);
+
+   // Append a segment, and flush it to disk.  Returns false on an I/O error.
+   bool Write (const std::vector <Tree> & roots);
+
+   bool Close();
+
+private:
+   // Collect() moves nodes, so after one the numbering is forgotten, and the
+   // next segment writes all its nodes again.  (Loading interns them, so the
+   // duplicates are harmless.)
+   static void VisitRoots (RootVisitor visit, void * data);
+
+   FILE * file;
+   std::string path;
+   std::string temporary;       // Where the file is until the first Write().
+   std::unordered_map <NodeRef, unsigned long long> number;
+   unsigned long long nodes;    // In the file so far.
+};
+
+#endif
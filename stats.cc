@@ -0,0 +1,150 @@
+
+// Runtime counters.
+
+#include "stats.hh"
+#include "intern.hh"
+
+#include <sys/resource.h>
+#include <time.h>
+
+THREAD_LOCAL TreeStats Stats;
+
+unsigned StatsEvery;
+
+TreeStats::TreeStats() :
+   pairCalls (0),
+   pairNew (0),
+   substCalls (0),
+   substClosed (0),
+   substDepth (0),
+   substMaxDepth (0),
+   applyCalls (0),
+   applyBeta (0),
+   machineRuns (0),
+   machineBeta (0),
+   deriveBodies (0),
+   deriveApply (0),
+   deriveWeaken (0),
+   derivePi (0),
+   deriveLambda (0),
+   deriveIntro (0),
+   peakNodes (0)
+{
+}
+
+TreeStats & TreeStats::operator+= (const TreeStats & other)
+{
+   pairCalls += other.pairCalls;
+   pairNew += other.pairNew;
+   substCalls += other.substCalls;
+   substClosed += other.substClosed;
+   if (substMaxDepth < other.substMaxDepth) {
+      substMaxDepth = other.substMaxDepth;
+   }
+   applyCalls += other.applyCalls;
+   applyBeta += other.applyBeta;
+   machineRuns += other.machineRuns;
+   machineBeta += other.machineBeta;
+   deriveBodies += other.deriveBodies;
+   deriveApply += other.deriveApply;
+   deriveWeaken += other.deriveWeaken;
+   derivePi += other.derivePi;
+   deriveLambda += other.deriveLambda;
+   deriveIntro += other.deriveIntro;
+   if (peakNodes < other.peakNodes) {
+      peakNodes = other.peakNodes;
+   }
+   return *this;
+}
+
+TreeStats operator- (const TreeStats & after, const TreeStats & before)
+{
+   TreeStats d = after;
+   d.pairCalls -= before.pairCalls;
+   d.pairNew -= before.pairNew;
+   d.substCalls -= before.substCalls;
+   d.substClosed -= before.substClosed;
+   d.applyCalls -= before.applyCalls;
+   d.applyBeta -= before.applyBeta;
+   d.machineRuns -= before.machineRuns;
+   d.machineBeta -= before.machineBeta;
+   d.deriveBodies -= before.deriveBodies;
+   d.deriveApply -= before.deriveApply;
+   d.deriveWeaken -= before.deriveWeaken;
+   d.derivePi -= before.derivePi;
+   d.deriveLambda -= before.deriveLambda;
+   d.deriveIntro -= before.deriveIntro;
+   return d;
+}
+
+static time_t StatsStart;
+static time_t StatsLast;
+
+void StartStats (unsigned every)
+{
+   StatsEvery = every;
+   StatsStart = StatsLast = time (NULL);
+}
+
+void PeriodicStats()
+{
+   time_t now = time (NULL);
+   if (now - StatsLast >= (time_t) StatsEvery) {
+      StatsLast = now;
+      std::cerr << "After " << now - StatsStart << "s:\n";
+      ReportStats (std::cerr, Stats);
+      ReportPeak (std::cerr, Stats);
+   }
+}
+
+void NotePeakNodes()
+{
+   size_t nodes = NodeCount();
+   if (Stats.peakNodes < nodes) {
+      Stats.peakNodes = nodes;
+   }
+}
+
+long PeakRss()
+{
+   struct rusage usage;
+   if (getrusage (RUSAGE_SELF, &usage) != 0) {
+      return 0;
+   }
+   return usage.ru_maxrss;
+}
+
+std::ostream & ReportStats (std::ostream & s, const TreeStats & stats)
+{
+#ifdef TREE_STATS
+   s << "  Pair: " << stats.pairCalls << " calls, "
+     << stats.pairCalls - stats.pairNew << " hits, "
+     << stats.pairNew << " new nodes.\n"
+     << "  Subst: " << stats.substCalls << " calls, "
+     << stats.substClosed << " closed, depth up to "
+     << stats.substMaxDepth << ".\n"
+     << "  Apply: " << stats.applyCalls << " calls, "
+     << stats.applyBeta << " beta, "
+     << stats.applyCalls - stats.applyBeta << " neutral.\n"
+     << "  Machine: " << stats.machineRuns << " runs, "
+     << stats.machineBeta << " beta.\n"
+     << "  Derive: " << stats.deriveBodies << " bodies; rules "
+     << stats.deriveApply << " APPLY, "
+     << stats.deriveWeaken << " weakening, "
+     << stats.derivePi << " PI, "
+     << stats.deriveLambda << " LAMBDA, "
+     << stats.deriveIntro << " variable.\n";
+#else
+   s << "  (Counters need -DTREE_STATS.)\n";
+#endif
+   return s;
+}
+
+std::ostream & ReportPeak (std::ostream & s, const TreeStats & stats)
+{
+   size_t peak = stats.peakNodes;
+   if (peak < NodeCount()) {
+      peak = NodeCount();
+   }
+   return s << "  Peak: " << peak << " nodes, " << PeakRss() << "kB RSS.\n";
+}
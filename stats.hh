@@ -0,0 +1,83 @@
+#ifndef STATS_HH_
+#define STATS_HH_
+
+// Counters of what the Tree runtime and pure.c's functions are doing, for
+// boot --stats.  They are only kept with -DTREE_STATS; otherwise TREE_STAT()
+// compiles to nothing, so a measured build pays nothing for them.
+
+// pure.c's Derive can't be instrumented without changing pure.c, so tree.cc
+// counts its rules from the operators it gives pure.c.
+
+#include "tree.hh"
+
+#include <iostream>
+
+struct TreeStats
+{
+   TreeStats();
+
+   unsigned long long pairCalls;        // Intern(), hits and misses.
+   unsigned long long pairNew;          // The misses, i.e., new nodes.
+   unsigned long long substCalls;
+   unsigned long long substClosed;      // Returned as is, by SkipClosed.
+   unsigned long long substDepth;       // Of the current call, whichever of
+                                        // pure.c, Shift or the machine.
+   unsigned long long substMaxDepth;
+   unsigned long long applyCalls;
+   unsigned long long applyBeta;        // The rest are neutral.
+   unsigned long long machineRuns;      // Of MachineSubst().
+   unsigned long long machineBeta;
+   unsigned long long deriveBodies;
+   unsigned long long deriveApply;      // The rules.
+   unsigned long long deriveWeaken;
+   unsigned long long derivePi;
+   unsigned long long deriveLambda;
+   unsigned long long deriveIntro;
+   size_t peakNodes;                    // As of the last Collect().
+
+   // Add in another thread's counters.
+   TreeStats & operator+= (const TreeStats & other);
+};
+
+// The counts since 'before'; the maxima are those of 'after'.
+TreeStats operator- (const TreeStats & after, const TreeStats & before);
+
+// Per thread, as for the memo tables.
+extern THREAD_LOCAL TreeStats Stats;
+
+#ifdef TREE_STATS
+#define TREE_STAT(expression) (expression)
+#else
+#define TREE_STAT(expression) ((void) 0)
+#endif
+
+// If non-zero, CountDerive() prints a report to std::cerr this often, in
+// seconds, for watching long runs.  Set it with StartStats(), which also
+// starts the clock that the reports give the time by.
+extern unsigned StatsEvery;
+
+void StartStats (unsigned every);
+
+void PeriodicStats();
+
+inline void CountDerive()
+{
+   if (++Stats.deriveBodies % 4096 == 0 && StatsEvery != 0) {
+      PeriodicStats();
+   }
+}
+
+// Record NodeCount() in peakNodes if it is a new peak.
+void NotePeakNodes();
+
+// The peak resident set size of the process, in kilobytes.
+long PeakRss();
+
+// Write the counters (if kept).
+std::ostream & ReportStats (std::ostream & s, const TreeStats & stats);
+
+// Write the peak nodes and RSS so far.  These are of the whole run, not of
+// the span that a difference of TreeStats covers.
+std::ostream & ReportPeak (std::ostream & s, const TreeStats & stats);
+
+#endif
@@ -1,37 +1,36 @@
 
+#include "machine.hh"
+#include "memo.hh"
+#include "stats.hh"
 #include "tree.hh"
 
 #include <assert.h>
-#include <set>
 #include <iostream>
+#include <limits.h>
 #include <unistd.h>
+#include <vector>
 
-struct NodeCompare
-{
-   bool operator() (const Node & a, const Node & b) const
-      {
-         return a.left != b.left ? a.left < b.left : a.right < b.right;
-      }
-};
-
-static std::set <Node, NodeCompare> CanonicalNodeSet;
-
-const Node * Pair (const Node * l,
-                   const Node * r)
-{
-   return &*CanonicalNodeSet.insert (Node (l, r)).first;
-}
+#ifdef THREADS
+#include <deque>
+#include <mutex>
+#include <thread>
+#endif
 
 int Tree::ToInt() const
 {
    if (IsNull())
       return 0;
 
+#ifdef NODE_METADATA
+   assert (Deref (it).value >= 0);
+   return Deref (it).value;
+#else
    int left = Left().ToInt();
    int right = Right().ToInt();
    assert (right < 32 &&
            ((0x80000000 >> right) & left) == 0);
    return (2 * left + 1) << right;
+#endif
 }
 
 static int iRight (int xx)
@@ -53,16 +52,21 @@ static int iLeft (int xx)
 }
 
 Tree::Tree (int xx) :
-   it (xx ? Pair (Tree (iLeft (xx)).it,
-                  Tree (iRight (xx)).it)
-       : NULL)
+   it (xx ? Intern (Tree (iLeft (xx)).it,
+                    Tree (iRight (xx)).it)
+       : NodeRef())
 {
 }
 
 bool Tree::operator== (int n) const
 {
    if (n == 0)
-      return it == NULL;
+      return IsNull();
+
+#ifdef NODE_METADATA
+   if (n > 0)
+      return !IsNull() && Deref (it).value == n;
+#endif
 
    else
       return !IsNull()
@@ -119,7 +123,7 @@ Tree Tree::Halve() const
       return Pair (Left(), Right().Decrement());
 }
 
-static Tree lastRight, accumulate;
+static THREAD_LOCAL Tree lastRight, accumulate;
 
 static inline Tree Left (Tree t)
 {
@@ -132,12 +136,113 @@ inline Tree Right (Tree t)
    return lastRight = t.Right();
 }
 
+#ifdef TREE_STATS
+// pure.c's Derive can't be instrumented directly, so with -DTREE_STATS its
+// rules are counted from operators that, of pure.c, only its body uses.  Each
+// turn of its loop does, in order:
+//  context - lastRight       Are the contexts the same?  If so:
+//    Left (lastRight) - aux  If type is a PI, can APPLY be used?  If so, and
+//                            the bit is set, APPLY calls Subst.
+//    aux / 2 & ...           Weakening.
+//  ~type & 2 | ...           Only for PI or LAMBDA; LAMBDA then does 1 << ...
+//  type / 2 & ...            Variable introduction.
+// PureStep follows where we are in that.  The iterative engine uses the same
+// operators but counts its rules itself, so this is only done within pure.c's
+// Derive, i.e., while PureDepth is non-zero.
+enum PureRuleStep {
+   RULE_START,                  // Before the contexts test.
+   RULE_MATCHED,                // The contexts are the same.
+   RULE_APPLY,                  // And so is aux, so a Subst now is for APPLY.
+   RULE_WEAKEN,                 // Past APPLY.
+   RULE_FORMATION,              // A PI, unless LAMBDA does 1 << ...
+   RULE_INTRO                   // Past PI and LAMBDA.
+};
+static THREAD_LOCAL unsigned PureDepth;
+static THREAD_LOCAL PureRuleStep PureStep;
+
+static void NoteMinus (bool equal)
+{
+   if (PureDepth != 0) {
+      PureStep = PureStep == RULE_START ? (equal ? RULE_MATCHED : RULE_START)
+         : equal ? RULE_APPLY : RULE_MATCHED;
+   }
+}
+
+static void NoteSubst()
+{
+   if (PureDepth != 0 && PureStep == RULE_APPLY) {
+      ++Stats.deriveApply;
+      PureStep = RULE_WEAKEN;
+   }
+}
+
+// The / 2 is taken before MAYBE, which may Lift(), so note which rule it is
+// for then, and whether the rule was used at the &.
+static void NoteHalve()
+{
+   if (PureDepth == 0) {
+      return;
+   }
+   if (PureStep == RULE_MATCHED || PureStep == RULE_APPLY) {
+      PureStep = RULE_WEAKEN;
+      return;
+   }
+   if (PureStep == RULE_FORMATION) {
+      ++Stats.derivePi;
+   }
+   PureStep = RULE_INTRO;
+}
+
+static void NoteRule (bool used)
+{
+   if (PureDepth == 0) {
+      return;
+   }
+   if (PureStep == RULE_WEAKEN) {
+      Stats.deriveWeaken += used;
+   }
+   else {
+      Stats.deriveIntro += used;
+   }
+   PureStep = RULE_START;
+}
+
+static void NoteFormation()
+{
+   if (PureDepth != 0) {
+      PureStep = RULE_FORMATION;
+   }
+}
+
+static void NoteLambda()
+{
+   if (PureDepth != 0 && PureStep == RULE_FORMATION) {
+      ++Stats.deriveLambda;
+      PureStep = RULE_START;
+   }
+}
+#endif
+
 inline Tree operator<< (int n, Tree t)
 {
    assert (n > 0 && (n & 1));
+#ifdef TREE_STATS
+   if (n == 1) {
+      NoteLambda();
+   }
+#endif
    return Tree (n >> 1, t);
 }
 
+// pure.c's functions take and return TREE, which is this.  Making it a type
+// of its own means that pure.c's calls to Apply() (all passing plain Trees)
+// resolve to the Apply (Tree, Tree) wrapper below, not to pure.c's definition.
+struct PureTree : Tree
+{
+   PureTree (const Tree & t) :
+      Tree (t) { }
+};
+
 class TreeMinusInt
 {
 public:
@@ -151,6 +256,11 @@ public:
       {
          return tree.ToInt() - number;
       }
+   // For "c ? t - n : yy" with yy a PureTree.
+   operator PureTree() const
+      {
+         return Tree (*this);
+      }
    Tree tree;
    int number;
 };
@@ -164,7 +274,10 @@ class TreeMinusTree
 {
 public:
    TreeMinusTree (Tree l, Tree r) :
-      equal (l == r) { }
+      equal (l == r)
+      {
+         TREE_STAT (NoteMinus (equal));
+      }
    operator const void *() const
       { return equal ? NULL : this; }
 private:
@@ -187,9 +300,11 @@ public:
    int operator& (int n) const
       {
          assert (n == 0 || n == 1);
-         return n && !tree.IsNull() &&
+         int applies = n && !tree.IsNull() &&
             (tree.Right() == One ||
              (tree.Right().IsNull() && tree.Left().Right().IsNull()));
+         TREE_STAT (NoteRule (applies));
+         return applies;
       }
    operator Tree() const
       { return tree.Halve(); }
@@ -200,6 +315,7 @@ private:
 static inline TreeSlashTwo operator/ (Tree t, int n)
 {
    assert (n == 2);
+   TREE_STAT (NoteHalve());
    return TreeSlashTwo (t);
 }
 
@@ -216,6 +332,7 @@ public:
    int operator& (int n) const
       {
          assert (n == 2);
+         TREE_STAT (NoteFormation());
          return !tree.IsNull() &&
             (tree.Right() == One ||
              (tree.Right().IsNull() && tree.Left().Right().IsNull())) ? 0 : 2;
@@ -229,17 +346,767 @@ static inline BitwiseNotTree operator~ (Tree t)
    return t;
 }
 
-typedef int INT;
-typedef Tree TREE;
-typedef Tree BitStream;
-TREE Apply (TREE, TREE);
+// The bitstream in Derive.  Halving a Tree interns a new node for every bit
+// consumed, as Pair (l, r) halves to Pair (l, r - 1).  Instead we keep our
+// place in the tree: the stream is tree >> shift, for shift up to the number
+// of trailing zeros of tree, so consuming a bit is just a count, until the
+// 1 bit is reached and we move on to tree.Left().  A Tree is only made when
+// someone wants the rest of the stream as one.
+class BitCursor
+{
+public:
+   BitCursor (Tree t) :
+      tree (t),
+      zeros (Zeros (t)),
+      shift (0)
+      { }
+
+   // xx /= 2.
+   BitCursor & operator/= (int n)
+      {
+         assert (n == 2);
+         if (tree.IsNull()) {
+         }
+         else if (shift == zeros) {
+            tree = tree.Left();
+            zeros = Zeros (tree);
+            shift = 0;
+         }
+         else {
+            ++shift;
+         }
+         return *this;
+      }
+
+   int operator% (int n) const
+      {
+         assert (n == 2);
+         return !tree.IsNull() && shift == zeros;
+      }
+
+   bool IsNull() const { return tree.IsNull(); }
+   operator const void *() const { return IsNull() ? NULL : this; }
+
+   operator Tree() const
+      {
+         if (shift == 0) {
+            return tree;
+         }
+         Tree rest = tree.Right();
+         if (zeros <= INT_MAX) {
+            rest = int (zeros - shift);
+         }
+         else {
+            for (unsigned long i = 0; i != shift; ++i) {
+               rest = rest.Decrement();
+            }
+         }
+         return Pair (tree.Left(), rest);
+      }
+
+   TreeMinusInt operator- (int n) const
+      {
+         return TreeMinusInt (*this, n);
+      }
+
+   Tree tree;                   // Public, for Collect() to update.
+
+private:
+   // The trailing zeros of t, i.e., t.Right() as a number, or ULONG_MAX if
+   // that's too big to be worth counting.
+   static unsigned long Zeros (Tree t)
+      {
+         return t.IsNull() ? 0 : Value (t.Right());
+      }
+   static unsigned long Value (Tree t)
+      {
+         if (t.IsNull()) {
+            return 0;
+         }
+         unsigned long l = Value (t.Left());
+         unsigned long r = Value (t.Right());
+         if (r >= 62 || l >= (1ul << (62 - r))) {
+            return ULONG_MAX;
+         }
+         return (2 * l + 1) << r;
+      }
+
+   unsigned long zeros;
+   unsigned long shift;
+};
+
+// INT only appears in the parameter list of pure.c's Subst().  Making it
+// expand to an extra tag parameter turns that definition into a six parameter
+// overload, so that all the four argument calls, including pure.c's own
+// recursive ones, go to the Subst (int, Tree, int, Tree) wrapper below.
+// BitStream does the same for Derive(), and makes the stream a BitCursor.
+struct PureTag { };
+#define INT PureTag, int
+#define BitStream PureTag, BitCursor
+typedef PureTree TREE;
+
+// pure.c's recursive call Derive (xx) passes the cursor as is.
+static Tree Derive (const BitCursor & xx);
 
 #define main MAIN
 #ifndef DESCEND
 #define DESCEND 0
+#define DESCENDS false
+#endif
+#ifndef DESCENDS
+#error "Define DESCENDS (true) along with DESCEND"
 #endif
 #include "pure.c"
 #undef main
+#undef INT
+#undef BitStream
+
+THREAD_LOCAL MemoTable SubstMemo ("Subst");
+THREAD_LOCAL MemoTable ApplyMemo ("Apply");
+
+bool SkipClosed = true;
+bool ShiftKernel = true;
+bool KrivineMachine = true;
+
+// Subst (vv, VAR opcode vv + 2, -4, term) replaces the variable vv by the next
+// one, and increments those above it.  That is all Lift does, and the calls
+// pure.c's Subst makes under binders while lifting are the same with vv and
+// the variable 2 higher.  So it just shifts the variables from vv up, and as
+// term is normal, so are the results, and Apply never reduces anything.
+static Tree Shift (Tree term, int cutoff)
+{
+#ifdef NODE_METADATA
+   if (SkipClosed && term.FreeTop() < cutoff) {
+      return term;
+   }
+#endif
+
+   Tree opcode = term.Left();
+   if (opcode.IsNull() || opcode == 1 || opcode == 2) {
+      // PI or LAMBDA, whose body is under a binder, or APPLY.
+      TREE_STAT (Stats.substMaxDepth < ++Stats.substDepth
+                 && (Stats.substMaxDepth = Stats.substDepth));
+      Tree result =
+         Pair (opcode, Pair (Shift (term.Right().Left(), cutoff),
+                             Shift (term.Right().Right(),
+                                    opcode == 2 ? cutoff : cutoff + 2)));
+      TREE_STAT (--Stats.substDepth);
+      return result;
+   }
+   if (opcode == 3 || !(opcode > cutoff - 1)) {
+      return term;
+   }
+   return Pair (opcode.Increment().Increment(), 0);
+}
+
+Tree Subst (int vv, Tree yy, int context, Tree term)
+{
+   TREE_STAT (++Stats.substCalls);
+   TREE_STAT (NoteSubst());
+#ifdef NODE_METADATA
+   // Everything pure.c substitutes into is normal, so if term has no variable
+   // at or above vv, Subst gives back term.
+   if (SkipClosed && term.FreeTop() < vv) {
+      TREE_STAT (++Stats.substClosed);
+      return term;
+   }
+#endif
+
+   MemoKey key (term, yy, vv, context);
+   Tree result;
+   if (SubstMemo.Lookup (key, result)) {
+      return result;
+   }
+   if (ShiftKernel && context == -4 &&
+       yy.Right().IsNull() && yy.Left() == vv + 2) {
+      result = Shift (term, vv);
+   }
+   else if (KrivineMachine) {
+      result = MachineSubst (vv, yy, context, term);
+   }
+   else {
+      TREE_STAT (Stats.substMaxDepth < ++Stats.substDepth
+                 && (Stats.substMaxDepth = Stats.substDepth));
+      result = Subst (PureTag(), vv, yy, PureTag(), context, term);
+      TREE_STAT (--Stats.substDepth);
+   }
+   SubstMemo.Insert (key, result);
+   return result;
+}
+
+Tree Apply (Tree yy, Tree xx)
+{
+   TREE_STAT (++Stats.applyCalls);
+   TREE_STAT (Stats.applyBeta += yy.Left() == 1);
+   MemoKey key (yy, xx);
+   Tree result;
+   if (ApplyMemo.Lookup (key, result)) {
+      return result;
+   }
+   result = Apply (PureTree (yy), PureTree (xx));
+   ApplyMemo.Insert (key, result);
+   return result;
+}
+
+// Derive() is memoised per bitstream.  What a call does is push some items
+// onto accumulate, the last being its judgment (term, type, leftover bits and
+// context), and return accumulate.  We record that as the node
+// Pair (accumulate after, accumulate before), and on a hit push the same items
+// again, so that accumulate ends up exactly as if we had called pure.c.
+THREAD_LOCAL MemoTable DeriveMemo ("Derive");
+THREAD_LOCAL unsigned long long DeriveReplayed;
+
+// Push onto accumulate the items of the list 'from', down to but not including
+// 'to', in the order they were originally pushed.  Return how many.
+static size_t PushItems (Tree from, Tree to)
+{
+   static THREAD_LOCAL std::vector <Tree> items;
+   items.clear();
+   for (Tree t = from; !(t == to); t = t.Right()) {
+      items.push_back (t.Left());
+   }
+   for (size_t i = items.size(); i != 0; --i) {
+      accumulate = Pair (items[i - 1], accumulate);
+   }
+   return items.size();
+}
+
+// Push onto accumulate the items recorded by DeriveMemo.
+static void Replay (Tree segment)
+{
+   DeriveReplayed += PushItems (segment.Left(), segment.Right());
+}
+
+Tree Derive (Tree xx)
+{
+   MemoKey key (xx, 0);
+   Tree segment;
+   if (DeriveMemo.Lookup (key, segment)) {
+      Replay (segment);
+      return accumulate;
+   }
+
+   Tree before = accumulate;
+   TREE_STAT (CountDerive());
+   TREE_STAT (++PureDepth);
+   Derive (PureTag(), xx);
+   TREE_STAT (--PureDepth);
+   DeriveMemo.Insert (key, Pair (accumulate, before));
+   return accumulate;
+}
+
+static Tree Derive (const BitCursor & xx)
+{
+   // DeriveMemo needs the stream as a Tree.
+   if (DeriveMemo.Enabled()) {
+      return Derive (Tree (xx));
+   }
+   TREE_STAT (CountDerive());
+   TREE_STAT (++PureDepth);
+   Tree result = Derive (PureTag(), xx);
+   TREE_STAT (--PureDepth);
+   return result;
+}
+
+std::ostream & ReportDeriveMemo (std::ostream & s)
+{
+   DeriveMemo.Report (s);
+   // Every call to pure.c's Derive pushes exactly one item.
+   unsigned long long derived = DeriveMemo.misses;
+   unsigned long long total = derived + DeriveReplayed;
+   s << "Derive judgments: " << derived << " derived, "
+     << DeriveReplayed << " replayed";
+   if (total != 0) {
+      s << " (" << 100 * DeriveReplayed / total << "% redundant)";
+   }
+   return s << ".\n";
+}
+
+// Derive (xx) again, but without recursing on the C stack.  This follows
+// pure.c's Derive step by step, with the calls it would make kept as frames on
+// DeriveStack, so it pushes exactly the same items onto accumulate (and
+// updates DeriveMemo in the same way).
+
+// With DESCEND, Derive (v) starts by calling Derive (v - 1), so Derive (xx)
+// amounts to running the rest of the body of Derive (v) for each of v = 0, 1,
+// ... xx in turn.  A frame does that by counting v up with Increment(), so the
+// recursion through Derive (xx - 1) costs no stack, and nothing ever converts
+// a bitstream to an int.
+struct DeriveFrame
+{
+   enum Step {
+      START,                    // Set up the body of Derive (value).
+      DESCEND_CALL,             // The "DESCEND && Derive (xx - 1)".
+      TEST,                     // The "MAYBE (1)" loop test.
+      COMBINE                   // Apply the rules, after Derive (xx) returns.
+   };
+
+   // The locals are set up by the START step.
+   DeriveFrame (Tree l, Tree v, Tree b) :
+      limit (l),
+      value (v),
+      before (b),
+      step (START),
+      whole (true),
+      xx (Tree (0)),
+      aux (0),
+      auxTerm (0),
+      context (0),
+      term (0),
+      type (0)
+      { }
+
+   Tree limit;                  // We are the call Derive (limit),
+   Tree value;                  // running the body of Derive (value),
+   Tree before;                 // and accumulate was this when we started.
+   Step step;
+   bool whole;                  // Whether we started at value 0 (or a hit).
+
+   // The locals of pure.c's Derive.
+   BitCursor xx;
+   Tree aux;
+   Tree auxTerm;
+   Tree context;
+   Tree term;
+   Tree type;
+};
+
+static THREAD_LOCAL std::vector <DeriveFrame> DeriveStack;
+
+// The Trees here that must survive Collect().
+static void TreeRoots (RootVisitor visit, void *)
+{
+   if (visit == NULL) {
+      return;
+   }
+
+   visit (Zero.it);
+   visit (One.it);
+   visit (Two.it);
+   visit (Three.it);
+   visit (lastRight.it);
+   visit (accumulate.it);
+
+   for (size_t i = 0; i != DeriveStack.size(); ++i) {
+      DeriveFrame & f = DeriveStack[i];
+      Tree * trees[] = { &f.limit, &f.value, &f.before, &f.xx.tree, &f.aux,
+                         &f.auxTerm, &f.context, &f.term, &f.type };
+      for (size_t j = 0; j != sizeof trees / sizeof trees[0]; ++j) {
+         visit (trees[j]->it);
+      }
+   }
+}
+
+static bool TreeRootsAdded = (AddRoots (TreeRoots, NULL), true);
+
+size_t CollectThreshold;
+size_t CollectedNodes;
+
+// Called between steps of DeriveIterative, when everything live is on
+// DeriveStack.  If most nodes survive, raise the threshold rather than
+// collecting again straight away.
+static void MaybeCollect()
+{
+   if (CollectThreshold == 0 || NodeCount() <= CollectThreshold) {
+      return;
+   }
+   CollectedNodes += Collect();
+   while (2 * NodeCount() > CollectThreshold) {
+      CollectThreshold *= 2;
+   }
+}
+
+// Whether pure.c was compiled with the recursive search (DESCEND is xx).
+static bool Descends()
+{
+   return DESCENDS;
+}
+
+// Start the call Derive (xx).  That is either replayed from DeriveMemo, or a
+// frame is pushed.  With DESCEND, the recursive version would look up xx,
+// xx - 1, ... until it hit something, so we do the same, and start the frame
+// just after the hit.
+static void DeriveCall (Tree xx, bool descend)
+{
+   DeriveFrame frame (xx, descend ? Tree (0) : xx, accumulate);
+
+   if (DeriveMemo.Enabled()) {
+      for (Tree v = xx; ; v = v.Decrement()) {
+         Tree segment;
+         if (DeriveMemo.Lookup (MemoKey (v, 0), segment)) {
+            Replay (segment);
+            if (v == xx) {
+               return;
+            }
+            frame.value = v.Increment();
+            break;
+         }
+         if (!descend || v.IsNull()) {
+            break;
+         }
+      }
+   }
+
+   DeriveStack.push_back (frame);
+}
+
+// pure.c's MAYBE, without the &&.
+static inline int NextBit (BitCursor & xx)
+{
+   return (xx /= 2) % 2;
+}
+
+// The loop body of Derive, after the sub-derivation Derive (xx) has returned.
+// The expressions mirror pure.c; note that a bit is consumed by the
+// weakening and variable introduction tests whether or not they apply.
+static void Combine (DeriveFrame & f)
+{
+   Tree item = accumulate.Left();
+   f.auxTerm = item.Left();
+   f.aux = item.Right().Left();
+   f.xx = item.Right().Right().Left();
+   Tree auxContext = item.Right().Right().Right();
+
+   if (f.context == auxContext) {
+      // APPLY.  type must be PI(aux,-).
+      if (f.type.Left().IsNull() &&
+          f.type.Right().Left() == f.aux &&
+          NextBit (f.xx)) {
+         f.type = Subst (4, f.auxTerm, 4, f.type.Right().Right());
+         f.term = Apply (f.term, f.auxTerm);
+         TREE_STAT (++Stats.deriveApply);
+      }
+
+      // Weakening.  aux must be STAR or BOX.
+      if (f.aux / 2 & NextBit (f.xx)) {
+         f.context = Pair (f.auxTerm, f.context);
+         f.term = Lift (f.term);
+         f.type = Lift (f.type);
+         TREE_STAT (++Stats.deriveWeaken);
+      }
+   }
+
+   if (f.context && NextBit (f.xx)) {
+      // PI formation or LAMBDA introduction.
+      int lambda = 0;
+      if (~f.type & 2 | NextBit (f.xx)) {
+         f.type = 1 << Pair (f.context.Left(), f.type);
+         lambda = 1;
+      }
+      f.term = Pair (lambda, Pair (f.context.Left(), f.term));
+      f.context = f.context.Right();
+      TREE_STAT (lambda ? ++Stats.deriveLambda : ++Stats.derivePi);
+   }
+
+   // Variable introduction.  type must be STAR or BOX.
+   if (f.type / 2 & NextBit (f.xx)) {
+      f.context = Pair (f.term, f.context);
+      f.type = Lift (f.term);
+      f.term = 9;
+      TREE_STAT (++Stats.deriveIntro);
+   }
+}
+
+// Run the frames above 'base' on DeriveStack to completion.  If 'collect',
+// nothing else holds on to Trees, so we may call Collect().
+static void RunDeriveStack (size_t base, bool descend, bool collect)
+{
+   while (DeriveStack.size() != base) {
+      if (collect) {
+         MaybeCollect();
+      }
+
+      // Careful: DeriveCall() may reallocate DeriveStack, invalidating f.
+      DeriveFrame & f = DeriveStack.back();
+
+      switch (f.step) {
+      case DeriveFrame::START:
+         TREE_STAT (CountDerive());
+         f.xx = f.value;
+         f.context = 0;
+         f.term = 7;
+         f.type = 14;
+         // Derive (value - 1) was the previous value, so skip the descent.
+         f.step = DeriveFrame::TEST;
+         break;
+
+      case DeriveFrame::DESCEND_CALL:
+         f.step = DeriveFrame::TEST;
+         if (descend && !f.xx.IsNull()) {
+            DeriveCall (Tree (f.xx).Decrement(), descend);
+         }
+         break;
+
+      case DeriveFrame::TEST:
+         if (NextBit (f.xx)) {
+            f.step = DeriveFrame::COMBINE;
+            DeriveCall (Tree (f.xx), descend);
+            break;
+         }
+
+         // Done with this value.
+         accumulate = Pair (
+            Pair (f.term, Pair (f.type, Pair (f.xx, f.context))), accumulate);
+         if (f.whole) {
+            DeriveMemo.Insert (MemoKey (f.value, 0),
+                               Pair (accumulate, f.before));
+         }
+
+         if (f.value == f.limit) {
+            DeriveStack.pop_back();
+         }
+         else {
+            f.value = f.value.Increment();
+            f.step = DeriveFrame::START;
+         }
+         break;
+
+      case DeriveFrame::COMBINE:
+         Combine (f);
+         f.step = DeriveFrame::DESCEND_CALL;
+         break;
+      }
+   }
+}
+
+Tree DeriveIterative (Tree xx)
+{
+   bool descend = Descends();
+   size_t base = DeriveStack.size();
+
+   DeriveCall (xx, descend);
+   RunDeriveStack (base, descend, base == 0);
+
+   return accumulate;
+}
+
+// DeriveParallel.  The bodies of Derive (v) for the different v only share
+// the interned nodes, the memo tables, and accumulate.  So each chunk of
+// values is run on a frame of its own, onto an empty accumulate, and the
+// resulting lists are then pushed in order onto the real accumulate.  Threads
+// start on chunks of their own, taken from the front of their queues, and
+// when they run out steal from the back of other threads' queues.
+struct DeriveChunk
+{
+   DeriveChunk (Tree f, Tree l) :
+      first (f),
+      last (l),
+      items (0)
+      { }
+
+   Tree first;
+   Tree last;
+   Tree items;                  // What the bodies of Derive pushed, reversed.
+};
+
+// Run the bodies of Derive (first) ... Derive (last).  A frame starting part
+// way through a range has not pushed the items for the values before it, so
+// must not be memoised.
+static void RunChunk (DeriveChunk & chunk, bool descend)
+{
+   Tree saved = accumulate;
+   accumulate = 0;
+
+   DeriveFrame frame (chunk.last, chunk.first, accumulate);
+   frame.whole = false;
+   size_t base = DeriveStack.size();
+   DeriveStack.push_back (frame);
+   RunDeriveStack (base, descend, false);
+
+   chunk.items = accumulate;
+   accumulate = saved;
+}
+
+#ifdef THREADS
+
+struct DeriveWorker
+{
+   std::mutex lock;
+   std::deque <size_t> queue;   // Indexes into DerivePool::chunks.
+};
+
+struct DerivePool
+{
+   DerivePool (std::vector <DeriveChunk> & c, unsigned threads, bool d) :
+      chunks (c),
+      workers (threads),
+      descend (d),
+      substMemo (&SubstMemo),
+      applyMemo (&ApplyMemo),
+      deriveMemo (&DeriveMemo),
+      deriveReplayed (&DeriveReplayed),
+      stats (&Stats)
+      { }
+
+   std::vector <DeriveChunk> & chunks;
+   std::vector <DeriveWorker> workers;
+   bool descend;
+
+   // The calling thread's tables, which the others copy the configuration of,
+   // and add their counts to when done.
+   MemoTable * substMemo;
+   MemoTable * applyMemo;
+   MemoTable * deriveMemo;
+   unsigned long long * deriveReplayed;
+   TreeStats * stats;
+   std::mutex statsLock;
+};
+
+static bool TakeChunk (DerivePool & pool, size_t self, size_t & chunk)
+{
+   {
+      DeriveWorker & own = pool.workers[self];
+      std::lock_guard <std::mutex> lock (own.lock);
+      if (!own.queue.empty()) {
+         chunk = own.queue.front();
+         own.queue.pop_front();
+         return true;
+      }
+   }
+
+   // No chunks are ever added, so once every queue is empty, we're done.
+   for (size_t i = 1; i != pool.workers.size(); ++i) {
+      DeriveWorker & victim = pool.workers[(self + i) % pool.workers.size()];
+      std::lock_guard <std::mutex> lock (victim.lock);
+      if (!victim.queue.empty()) {
+         chunk = victim.queue.back();
+         victim.queue.pop_back();
+         return true;
+      }
+   }
+
+   return false;
+}
+
+static void DeriveThread (DerivePool * pool, size_t self)
+{
+   // Worker 0 is the calling thread, and already has the right tables.
+   if (self != 0) {
+      SubstMemo.ConfigureLike (*pool->substMemo);
+      ApplyMemo.ConfigureLike (*pool->applyMemo);
+      DeriveMemo.ConfigureLike (*pool->deriveMemo);
+   }
+
+   size_t chunk;
+   while (TakeChunk (*pool, self, chunk)) {
+      RunChunk (pool->chunks[chunk], pool->descend);
+   }
+
+   if (self != 0) {
+      std::lock_guard <std::mutex> lock (pool->statsLock);
+      pool->substMemo->Absorb (SubstMemo);
+      pool->applyMemo->Absorb (ApplyMemo);
+      pool->deriveMemo->Absorb (DeriveMemo);
+      *pool->deriveReplayed += DeriveReplayed;
+      *pool->stats += Stats;
+   }
+}
+
+static void RunChunks (std::vector <DeriveChunk> & chunks, unsigned threads,
+                       bool descend)
+{
+   if (threads > chunks.size()) {
+      threads = chunks.size();
+   }
+
+   // Deal out the chunks in contiguous runs, so that each thread starts on
+   // values close together, which share more of their sub-derivations.
+   DerivePool pool (chunks, threads, descend);
+   for (size_t i = 0; i != chunks.size(); ++i) {
+      pool.workers[i * threads / chunks.size()].queue.push_back (i);
+   }
+
+   std::vector <std::thread> others;
+   for (unsigned i = 1; i < threads; ++i) {
+      others.push_back (std::thread (DeriveThread, &pool, i));
+   }
+   DeriveThread (&pool, 0);
+   for (size_t i = 0; i != others.size(); ++i) {
+      others[i].join();
+   }
+}
+
+#else
+
+// Just run them one after another.
+static void RunChunks (std::vector <DeriveChunk> & chunks, unsigned threads,
+                       bool descend)
+{
+   for (size_t i = 0; i != chunks.size(); ++i) {
+      RunChunk (chunks[i], descend);
+   }
+}
+
+#endif
+
+Tree DeriveParallel (Tree xx, unsigned threads, size_t chunk)
+{
+   bool descend = Descends();
+   if (!descend || chunk == 0) {
+      return DeriveIterative (xx);
+   }
+
+   std::vector <DeriveChunk> chunks;
+   for (Tree v = 0; ; v = v.Increment()) {
+      Tree first = v;
+      for (size_t n = 1; n < chunk && !(v == xx); ++n) {
+         v = v.Increment();
+      }
+      chunks.push_back (DeriveChunk (first, v));
+      if (v == xx) {
+         break;
+      }
+   }
+
+   RunChunks (chunks, threads, descend);
+
+   Tree before = accumulate;
+   for (size_t i = 0; i != chunks.size(); ++i) {
+      PushItems (chunks[i].items, 0);
+   }
+   DeriveMemo.Insert (MemoKey (xx, 0), Pair (accumulate, before));
+   return accumulate;
+}
+
+Tree DeriveFrom (Tree x, Tree value, Tree items, size_t chunk,
+                 DeriveProgress progress, void * data)
+{
+   bool descend = Descends();
+   if (chunk == 0) {
+      chunk = 1;
+   }
+
+   // Without the recursive search, the only value is xx itself.
+   RootedTree xx = x;
+   RootedTree next = descend || !value.IsNull() ? value : x;
+   RootedTree end = xx.Increment();
+   RootedTree before = items;
+   accumulate = items;
+
+   RootedTree last;
+   while (!(next == end)) {
+      last = next;
+      for (size_t n = 1; n < chunk && !(last == xx); ++n) {
+         last = last.Increment();
+      }
+
+      DeriveFrame frame (last, next, accumulate);
+      frame.whole = false;
+      size_t base = DeriveStack.size();
+      DeriveStack.push_back (frame);
+      RunDeriveStack (base, descend, base == 0);
+
+      next = last.Increment();
+      if (progress != NULL && !progress (next, accumulate, data)) {
+         return accumulate;
+      }
+   }
+
+   if (value.IsNull()) {
+      DeriveMemo.Insert (MemoKey (xx, 0), Pair (accumulate, before));
+   }
+   return accumulate;
+}
 
 // The operator<< is specific to terms...
 std::ostream & operator<< (std::ostream & s, Tree tree)
@@ -4,46 +4,96 @@
 #include <assert.h>
 #include <iostream>
 #include <stddef.h>
+#include <stdint.h>
+
+struct Node;
+
+// With -DTHREADS, Intern() is thread safe, and the state that pure.c's
+// functions keep between calls is per thread, so that DeriveParallel() can run
+// them on several threads at once.
+#ifdef THREADS
+#define THREAD_LOCAL thread_local
+#else
+#define THREAD_LOCAL
+#endif
+
+// How a Node is referred to.  Normally this is just a pointer.  With
+// -DCOMPACT_NODES, all nodes live in the one array NodeArena and are referred
+// to by 32-bit index, which halves the size of a Node on 64-bit hosts.  Either
+// way, a value-initialised NodeRef (NULL or 0) is the null tree.
+#ifdef COMPACT_NODES
+typedef uint32_t NodeRef;
+extern Node * NodeArena;
+#else
+typedef const Node * NodeRef;
+#endif
 
 // This is the raw data storage for our syntax trees.
 struct Node
 {
-   Node (const Node * l = NULL,
-         const Node * r = NULL) :
+   Node (NodeRef l = NodeRef(),
+         NodeRef r = NodeRef()) :
       left (l),
       right (r)
       { }
    bool operator== (const Node & other) const
       { return left == other.left && right == other.right; }
 
-   const Node * left;
-   const Node * right;
+   NodeRef left;
+   NodeRef right;
+
+#ifdef NODE_METADATA
+   // With -DNODE_METADATA, Intern() fills these in when it creates the node,
+   // from those of the children.  They are read through the Tree accessors.
+   uint64_t hash;               // Structural, so the same in every run.
+   uint32_t height;             // 1 + the greater height of the children.
+   uint32_t size;               // Nodes in the tree (not DAG), saturating.
+   int32_t value;               // ToInt(), or -1 if that won't fit.
+   int32_t freeTop;             // See Tree::FreeTop().
+#endif
 };
 
-// The pairing function on the raw data.
-const Node * Pair (const Node * l,
-                   const Node * r);
+inline const Node & Deref (NodeRef ref)
+{
+#ifdef COMPACT_NODES
+   return NodeArena[ref];
+#else
+   return *ref;
+#endif
+}
+
+// The pairing function on the raw data.  This is hash-consed: see intern.hh.
+// It is not an overload of Pair(), as with COMPACT_NODES that would capture
+// calls such as Pair (3, 0).
+NodeRef Intern (NodeRef l,
+                NodeRef r);
 
 // This wrapper class is what everything uses.
 struct Tree {
 
    Tree() { }
    Tree (int n);
-   Tree (const Node * node) :
-      it (node) { }
    Tree (const Tree & other) :
       it (other.it) { }
    Tree (const Tree & l, const Tree & r) :
-      it (Pair (l.it, r.it)) { }
+      it (Intern (l.it, r.it)) { }
+
+   static Tree FromRef (NodeRef node)
+      {
+         Tree result;
+         result.it = node;
+         return result;
+      }
 
-   Tree Left() const { return it->left; }
-   Tree Right() const { return it->right; }
+   Tree Left() const { return FromRef (Deref (it).left); }
+   Tree Right() const { return FromRef (Deref (it).right); }
 
-   bool IsNull() const { return it == NULL; }
+   bool IsNull() const { return it == NodeRef(); }
 
    // This is really a conversion to bool, except by converting to void* we
-   // avoid accidentally carrying out arithmetic on the result.
-   operator const void *() const { return it; }
+   // avoid accidentally carrying out arithmetic on the result.  It is also
+   // unique per node, and Trees do get compared through it.
+   operator const void *() const { return IsNull() ? NULL : &Deref (it); }
 
    bool operator== (const Tree & other) const
       { return it == other.it; }
@@ -78,7 +128,23 @@ struct Tree {
    // Convert to an int.
    int ToInt() const;
 
-   const Node * it;
+#ifdef NODE_METADATA
+   // Structural facts, in O(1).
+   uint64_t Hash() const
+      { return IsNull() ? 0 : Deref (it).hash; }
+   unsigned Height() const
+      { return IsNull() ? 0 : Deref (it).height; }
+   unsigned Size() const
+      { return IsNull() ? 0 : Deref (it).size; }
+
+   // Reading the tree as a term, the greatest opcode of a free variable (VAR n
+   // is opcode 4 + 2n), or 3 if there are none.  So the term mentions no
+   // variable at or above opcode k exactly when FreeTop() < k.
+   int FreeTop() const
+      { return IsNull() ? 3 : Deref (it).freeTop; }
+#endif
+
+   NodeRef it;
 };
 
 inline Tree Pair (const Tree & l,
@@ -87,11 +153,53 @@ inline Tree Pair (const Tree & l,
    return Tree (l, r);
 }
 
-// The stuff that pure gives us...
+// The stuff that pure gives us...  Subst and Apply go through the memo tables
+// in memo.hh.
 Tree Subst (int, Tree, int, Tree);
 Tree Apply (Tree, Tree);
 Tree Derive (Tree);
 
+// The same as Derive, but using a heap allocated stack rather than recursion.
+Tree DeriveIterative (Tree);
+
+// Shortcuts in the Subst wrapper, on by default; they can be turned off to
+// compare.  SkipClosed returns a term unchanged when its FreeTop() shows that
+// it has no variable to substitute for (this needs NODE_METADATA).
+// ShiftKernel does Lift with a plain shift of variables, rather than the
+// general Subst and Apply.  KrivineMachine does the rest of Subst (and so
+// Apply's beta reductions) with the abstract machine in machine.hh, rather
+// than pure.c's recursion.
+extern bool SkipClosed;
+extern bool ShiftKernel;
+extern bool KrivineMachine;
+
+// If non-zero, DeriveIterative calls Collect() (see intern.hh) when there are
+// more than this many nodes, so the caller must hold its Trees in roots.  The
+// threshold is raised as needed so that a collection frees at least half.
+extern size_t CollectThreshold;
+
+// The nodes freed by those collections, and by any the caller adds in.
+extern size_t CollectedNodes;
+
+// The same again, but with the values 0 ... xx that the recursive search runs
+// through split into chunks of 'chunk' values, and the chunks shared out
+// between 'threads' threads.  The result is identical to Derive's.  Without
+// -DTHREADS the chunks are run one after another.  If pure.c was compiled
+// without the recursive search, this is just DeriveIterative.
+Tree DeriveParallel (Tree xx, unsigned threads, size_t chunk = 1);
+
+// Derive in stages that can be checkpointed and resumed.  This runs the
+// bodies of Derive (xx) for the values 'value' ... xx, in order and 'chunk'
+// at a time, onto 'items', which is what accumulate was when 'value' was
+// reached; so DeriveFrom (xx, 0, a, n) is Derive (xx) from accumulate a.
+// After each chunk it calls progress (next, accumulated, data), with the value
+// to resume from (xx + 1 when done); if that returns false it stops there.
+// Returns accumulate.  As for DeriveIterative, with CollectThreshold set the
+// caller must hold its Trees in roots.
+typedef bool (*DeriveProgress) (Tree next, Tree accumulated, void * data);
+Tree DeriveFrom (Tree xx, Tree value, Tree items, size_t chunk,
+                 DeriveProgress progress = NULL, void * data = NULL);
+
 // The operator<< is specific to terms...
 std::ostream & operator<< (std::ostream & s, Tree tree);
 std::ostream & PrintContext (std::ostream & s, Tree tree);
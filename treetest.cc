@@ -0,0 +1,178 @@
+// Checks of the Tree runtime: interning, arithmetic, memoisation and garbage
+// collection.
+
+#include "intern.hh"
+#include "memo.hh"
+#include "snapshot.hh"
+#include "tree.hh"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <vector>
+
+int main()
+{
+#ifndef NODE_METADATA
+   assert (sizeof (Node) == 2 * sizeof (NodeRef));
+#endif
+   assert (Tree (0).IsNull() && !Tree (1).IsNull());
+
+   // Interning: equal pairs are the same node, and numbers round trip.
+   for (int i = 0; i != 100000; ++i) {
+      Tree t = i;
+      assert (t.ToInt() == i);
+      assert (t == i);
+      assert (t == Tree (i));
+      if (i != 0) {
+         assert (Pair (t.Left(), t.Right()) == t);
+      }
+   }
+   size_t nodes = NodeCount();
+   for (int i = 0; i != 100000; ++i) {
+      Tree t = i;
+      assert (t == i);
+   }
+   assert (NodeCount() == nodes);
+   assert (InternCapacity() == 0 || 2 * nodes <= InternCapacity());
+
+   // Arithmetic.
+   for (int i = 0; i != 10000; ++i) {
+      Tree t = i;
+      assert (t.Increment() == i + 1);
+      assert (t.Double() == 2 * i);
+      assert (t.Halve() == i / 2);
+      if (i != 0) {
+         assert (t.Decrement() == i - 1);
+      }
+   }
+
+#ifdef NODE_METADATA
+   // The metadata agrees with what it caches.
+   for (int i = 1; i != 10000; ++i) {
+      Tree t = i;
+      unsigned lh = t.Left().Height(), rh = t.Right().Height();
+      assert (t.Height() == 1 + (lh > rh ? lh : rh));
+      assert (t.Size() == 1 + t.Left().Size() + t.Right().Size());
+      assert (t.Hash() != t.Left().Hash() && t.Hash() != t.Right().Hash());
+   }
+   Tree star = 7, var0 = 9, var1 = 13;
+   assert (star.FreeTop() == 3 && var1.FreeTop() == 6);
+   assert (Pair (0, Pair (star, var0)).FreeTop() == 3);
+   assert (Pair (1, Pair (var0, var1)).FreeTop() == 4);
+   assert (Pair (2, Pair (var1, var0)).FreeTop() == 6);
+#endif
+
+   // Derive gives the same judgments with and without memoisation.  As well
+   // as small bitstreams, use the encoding (from parse) of
+   // [P:*][f:P>P][x:P]f (f x), which exercises Apply.
+   const char * twice =
+      "0011010110101101000010101000110100111001110011001000100011010011"
+      "10011100111011010011100110010001000110100111001110011101101001110010";
+   Tree bits = 0;
+   for (const char * p = twice; *p; ++p) {
+      bits = bits.Double();
+      if (*p == '1') {
+         bits = bits.Increment();
+      }
+   }
+
+   const int derivations = 1 << 14;
+   std::vector <Tree> plain;
+   for (int i = 0; i != derivations; ++i) {
+      plain.push_back (Derive (i).Left());
+   }
+   plain.push_back (Derive (bits).Left());
+
+   SubstMemo.Configure (1 << 12);
+   ApplyMemo.Configure (1 << 12, 1, MemoTable::FIFO);
+   for (int i = 0; i != derivations; ++i) {
+      assert (Derive (i).Left() == plain[i]);
+   }
+   assert (Derive (bits).Left() == plain[derivations]);
+   assert (Derive (bits).Left() == plain[derivations]);
+   assert (SubstMemo.hits != 0 && ApplyMemo.hits != 0);
+   SubstMemo.Configure (0);
+   ApplyMemo.Configure (0);
+
+   // Memoised Derive pushes the same items onto accumulate.
+   Tree before = Derive (bits);
+   Tree after = Derive (bits);
+   DeriveMemo.Configure (1 << 10);
+   Tree memoBefore = Derive (bits);
+   Tree memoAfter = Derive (bits);
+   assert (DeriveMemo.hits == 1 && DeriveReplayed != 0);
+   for (; !(after == before); after = after.Right()) {
+      assert (after.Left() == memoAfter.Left());
+      memoAfter = memoAfter.Right();
+   }
+   assert (memoAfter == memoBefore);
+   DeriveMemo.Configure (0);
+
+   // DeriveIterative gives the same judgments as Derive.
+   for (int i = 0; i != derivations; ++i) {
+      assert (DeriveIterative (i).Left() == plain[i]);
+   }
+   assert (DeriveIterative (bits).Left() == plain[derivations]);
+
+   // So do the general Subst and Apply, without the wrapper's shortcuts.
+   ShiftKernel = false;
+   SkipClosed = false;
+   for (int i = 0; i != derivations; ++i) {
+      assert (Derive (i).Left() == plain[i]);
+   }
+   assert (Derive (bits).Left() == plain[derivations]);
+   ShiftKernel = true;
+   SkipClosed = true;
+
+   // And so does pure.c's Subst, in place of the machine; and they agree on
+   // Apply where it has real work, Church numeral 3 applied to itself.
+   Tree three = Pair (1, Pair (Pair (0, Pair (7, 7)), Pair (1, Pair (7,
+      Pair (2, Pair (13, Pair (2, Pair (13, Pair (2, Pair (13, 9))))))))));
+   Tree power = Apply (three, three);
+   KrivineMachine = false;
+   for (int i = 0; i != derivations; ++i) {
+      assert (Derive (i).Left() == plain[i]);
+   }
+   assert (Derive (bits).Left() == plain[derivations]);
+   assert (Apply (three, three) == power);
+   KrivineMachine = true;
+
+   // A snapshot loads back as the same nodes, and rejects a truncated file.
+   {
+      const char * path = "treetest.snapshot";
+      std::vector <Tree> roots;
+      roots.push_back (plain[derivations]);
+      roots.push_back (0);
+      roots.push_back (bits);
+      assert (SaveSnapshot (path, roots));
+      std::vector <Tree> loaded;
+      assert (LoadSnapshot (path, loaded) && loaded == roots);
+      FILE * file = fopen (path, "r+");
+      fseek (file, 0, SEEK_END);
+      assert (ftruncate (fileno (file), ftell (file) - 1) == 0);
+      fclose (file);
+      assert (!LoadSnapshot (path, loaded));
+      remove (path);
+   }
+
+   // Collect() keeps what is rooted, and interning still finds it.
+   {
+      RootedTree kept = Tree (123456);
+      RootedTree judgment = plain[derivations];
+      SubstMemo.Configure (1024);
+      SkipClosed = false;
+      Tree lifted = Subst (4, 13, -4, judgment.Left());
+      RootedTree keptLifted = lifted;
+      size_t before = NodeCount();
+      assert (Collect() != 0 && NodeCount() < before);
+      assert (kept.ToInt() == 123456 && kept == Tree (123456));
+      assert (Pair (judgment.Left(), judgment.Right()) == judgment);
+      size_t hits = SubstMemo.hits;
+      assert (Subst (4, 13, -4, judgment.Left()) == keptLifted);
+      assert (SubstMemo.hits == hits + 1);
+      SubstMemo.Configure (0);
+      SkipClosed = true;
+   }
+
+   return 0;
+}
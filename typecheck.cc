@@ -0,0 +1,195 @@
+// The type checker.
+
+#include "typecheck.hh"
+#include "parse.hh"
+
+TypeChecker::TypeChecker (size_t size) :
+   term (0),
+   expected (0),
+   actual (0),
+   cache ("Type")
+{
+   cache.Configure (size);
+}
+
+TypeChecker::Error TypeChecker::Infer (const Context & c, Tree t,
+                                       Tree & type)
+{
+   MemoKey key (c.list, t);
+   if (cache.Lookup (key, type)) {
+      return OK;
+   }
+   Error error = Synthesise (c, t, type);
+   if (error == OK) {
+      cache.Insert (key, type);
+   }
+   return error;
+}
+
+TypeChecker::Error TypeChecker::Check (const Context & c, Tree t, Tree type)
+{
+   // A LAMBDA against a PI with the same domain: check the body against the
+   // codomain.
+   if (t.Left() == 1) {
+      Tree whType = WeakHeadNormalise (type);
+      if (whType.Left() == 0
+          && NormalisedEquals (t.Right().Left(), whType.Right().Left())) {
+         Error error = Sort (c, t.Right().Left());
+         if (error != OK) {
+            return error;
+         }
+         return Check (c.Push (t.Right().Left()), t.Right().Right(),
+                       whType.Right().Right());
+      }
+   }
+
+   Tree inferred;
+   Error error = Infer (c, t, inferred);
+   if (error != OK) {
+      return error;
+   }
+   if (!NormalisedEquals (inferred, type)) {
+      expected = type;
+      actual = inferred;
+      return Fail (MISMATCH, c, t);
+   }
+   return OK;
+}
+
+TypeChecker::Error TypeChecker::Synthesise (const Context & c, Tree t,
+                                            Tree & type)
+{
+   int opcode = t.Left().ToInt();
+   switch (opcode) {
+   case 0: {
+      // PI: the domain is a type, and the PI has the type of its codomain.
+      Error error = Sort (c, t.Right().Left());
+      if (error != OK) {
+         return error;
+      }
+      Context inner = c.Push (t.Right().Left());
+      error = Infer (inner, t.Right().Right(), type);
+      if (error != OK) {
+         return error;
+      }
+      type = WeakHeadNormalise (type);
+      if (type.Left() != 3) {
+         actual = type;
+         return Fail (NOT_A_TYPE, inner, t.Right().Right());
+      }
+      return OK;
+   }
+   case 1: {
+      // LAMBDA.
+      Error error = Sort (c, t.Right().Left());
+      if (error != OK) {
+         return error;
+      }
+      Tree body;
+      error = Infer (c.Push (t.Right().Left()), t.Right().Right(), body);
+      if (error != OK) {
+         return error;
+      }
+      type = Pair (0, Pair (t.Right().Left(), body));
+      return OK;
+   }
+   case 2: {
+      // APPLY.
+      Tree function;
+      Error error = Infer (c, t.Right().Left(), function);
+      if (error != OK) {
+         return error;
+      }
+      Tree whFunction = WeakHeadNormalise (function);
+      if (whFunction.Left() != 0) {
+         actual = function;
+         return Fail (NOT_A_FUNCTION, c, t.Right().Left());
+      }
+      error = Check (c, t.Right().Right(), whFunction.Right().Left());
+      if (error != OK) {
+         return error;
+      }
+      type = Subst (whFunction.Right().Right(), 0, t.Right().Right());
+      return OK;
+   }
+   case 3:
+      if (!(t.Right() == 0)) {
+         return Fail (UNTYPED, c, t);
+      }
+      type = Pair (3, 1);       // BOX.
+      return OK;
+
+   default: {
+      // A variable: its type is the context item, lifted past it and the
+      // items after it.
+      size_t var = (opcode >> 1) - 2;
+      Tree list = c.list;
+      for (size_t i = 0; i != var && !list.IsNull(); ++i) {
+         list = list.Right();
+      }
+      if (list.IsNull()) {
+         return Fail (FREE_VARIABLE, c, t);
+      }
+      type = list.Left();
+      for (size_t i = 0; i <= var; ++i) {
+         type = Lift (type, 0);
+      }
+      return OK;
+   }
+   }
+}
+
+// Check that t is a type (or kind): its type is * (or #).
+TypeChecker::Error TypeChecker::Sort (const Context & c, Tree t)
+{
+   Tree type;
+   Error error = Infer (c, t, type);
+   if (error != OK) {
+      return error;
+   }
+   if (WeakHeadNormalise (type).Left() != 3) {
+      actual = type;
+      return Fail (NOT_A_TYPE, c, t);
+   }
+   return OK;
+}
+
+TypeChecker::Error TypeChecker::Fail (Error error, const Context & c, Tree t)
+{
+   context = c;
+   term = t;
+   return error;
+}
+
+std::ostream & TypeChecker::Report (std::ostream & s, Error error,
+                                    const SourcePositions * positions) const
+{
+   switch (error) {
+   case OK:
+      return s << "OK";
+   case FREE_VARIABLE:
+      s << "Free variable";
+      break;
+   case UNTYPED:
+      s << "# has no type";
+      break;
+   case NOT_A_TYPE:
+      s << "Not a type: its type is " << actual;
+      break;
+   case NOT_A_FUNCTION:
+      s << "Not a function: its type is " << actual;
+      break;
+   case MISMATCH:
+      s << "Expected type " << expected << ", got " << actual;
+      break;
+   }
+
+   if (positions != NULL) {
+      SourcePositions::const_iterator p =
+         positions->find (std::make_pair (term.it, context.size()));
+      if (p != positions->end()) {
+         return s << " at position " << p->second;
+      }
+   }
+   return s << " in " << term;
+}
@@ -0,0 +1,62 @@
+#ifndef TYPECHECK_HH_
+#define TYPECHECK_HH_
+
+// A type checker for the terms of parse.hh, working on the term directly
+// rather than encoding it and running it through Derive.  It is bidirectional:
+// Infer() finds the type of a term, and Check() checks a term against a type
+// it should have, which lets a LAMBDA be checked against a PI without building
+// the PI's type.  Conversion is NormalisedEquals, with the engine parse.hh
+// chooses.  Types are not normalised, only weak head normalised as needed.
+
+// The rules are Derive's: in particular, a LAMBDA's body may have type #, as
+// Derive allows LAMBDA introduction whatever the type.
+
+#include "batchparse.hh"
+#include "bitstream.hh"
+#include "memo.hh"
+#include "tree.hh"
+
+class TypeChecker
+{
+public:
+   enum Error {
+      OK,
+      FREE_VARIABLE,            // term is a variable not in context.
+      UNTYPED,                  // term is #, which has no type.
+      NOT_A_TYPE,               // term's type should be * or #, but is actual.
+      NOT_A_FUNCTION,           // term is applied, but its type actual is not
+                                // a PI.
+      MISMATCH                  // term has type actual, not expected.
+   };
+
+   // The types inferred are cached for (context, term), in about 'size'
+   // entries.
+   TypeChecker (size_t size = 1 << 16);
+
+   // Find the type of term in context.
+   Error Infer (const Context & context, Tree term, Tree & type);
+
+   // Check that term has type 'type' in context.
+   Error Check (const Context & context, Tree term, Tree type);
+
+   // Where the last error was: the subterm, its context, and the types
+   // involved.
+   Context context;
+   Tree term;
+   Tree expected;
+   Tree actual;
+
+   // Describe the last error.  With the positions from BatchParser, say where
+   // in the input it was.
+   std::ostream & Report (std::ostream & s, Error error,
+                          const SourcePositions * positions = NULL) const;
+
+   MemoTable cache;
+
+private:
+   Error Synthesise (const Context & c, Tree t, Tree & type);
+   Error Sort (const Context & c, Tree t);
+   Error Fail (Error error, const Context & c, Tree t);
+};
+
+#endif